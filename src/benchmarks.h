@@ -0,0 +1,584 @@
+/*
+    Micro-benchmarks of the firmware's hot paths. The same table runs on a PC (pio run -e native-bench, then
+    .pio/build/native-bench/program bench) and on the kettle (pio run -e esp32dev-bench -t upload, the results
+    come out on the serial console at boot, before WiFi is started).
+
+    Every case is run in a doubling loop until one run takes at least benchTargetUs, then that many calls are
+    timed benchRepeats more times and the fastest is reported, which keeps out most of what else the machine did:
+      ns/op       wall time per call
+      cycles/op   CPU cycles per call from the ESP32's cycle counter, or the TSC on an x86 PC (0 elsewhere)
+      allocs/op   heap allocations per call. Counted by wrapping malloc, calloc and realloc at link time
+                  (BENCH_COUNT_ALLOCS and -Wl,--wrap in platformio.ini), which catches new and String as well
+      B/op        bytes those allocations asked for
+      out         bytes of output one call produced
+      B/sample    for the cases that store or stream samples, out per sample, against the 6 bytes of a tempSample
+    one line per case, in the same format as the baselines in bench/. Given a baseline, benchCompare() marks
+    every case that got more than benchSlower slower or allocates more than it did. Allocations compare on
+    any machine, times only on the machine the baseline was taken on.
+
+    The archive cases store real readings: on a PC the control probe's readings from the golden trace
+    (test/traces/goldenTrace.h), taken every TEMP_READ_FREQ like the control step does, one recorded fill and
+    heat after another. That is the hard case for the compression, a kettle that mostly stands does better. The
+    kettle has no copy of the trace and uses the made up heating curve from benchSample() instead.
+
+    Include from exactly one .cpp, after kettleControl.h.
+*/
+
+#ifndef BENCHMARKS
+#define BENCHMARKS
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <list>
+#include <sys/stat.h>
+
+#include <vector>
+
+#include "kettleControl.h"
+#include "jsonStream.h"
+#include "binaryExport.h"
+#include "historyLog.h"
+#ifndef ARDUINO
+#include "traces/goldenTrace.h"   // -I test, like the unit tests
+#endif
+
+#ifdef ARDUINO
+#include <esp_timer.h>
+inline uint64_t benchNowNs() { return esp_timer_get_time() * 1000ULL; }
+inline uint32_t benchCycles() { return ESP.getCycleCount(); }   // wraps every 18s at 240MHz, runs are far shorter
+typedef uint32_t benchCycleCount;
+inline void benchPrint(const char* line) { Serial.println(line); }
+#else
+#include <time.h>
+#include <string>
+inline uint64_t benchNowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+inline uint64_t benchCycles() { return __rdtsc(); }
+#else
+inline uint64_t benchCycles() { return 0; }
+#endif
+typedef uint64_t benchCycleCount;
+inline void benchPrint(const char* line) { puts(line); }   // not halLog(), the native build quietens that for controlStep
+#endif
+
+// Heap allocations made by anything, only counted with BENCH_COUNT_ALLOCS (see above)
+uint32_t benchAllocs = 0;
+uint32_t benchAllocBytes = 0;
+
+#ifdef BENCH_COUNT_ALLOCS
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+void* __wrap_malloc(size_t size) {
+  benchAllocs++;
+  benchAllocBytes += size;
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+  benchAllocs++;
+  benchAllocBytes += n * size;
+  return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* p, size_t size) {
+  benchAllocs++;
+  benchAllocBytes += size;
+  return __real_realloc(p, size);
+}
+}
+
+#ifndef ARDUINO
+// On a PC new is in the shared libstdc++, whose own calls to malloc the wrapping doesn't see, so send new
+// through this file's malloc. The ESP32 links libstdc++ statically and needs none of this.
+#include <new>
+void* operator new(size_t size) {
+  void* p = malloc(size ? size : 1);
+  if(p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+#endif
+#endif
+
+struct benchResult {
+  char name[24];
+  uint32_t iterations;
+  double nsPerOp;
+  double cyclesPerOp;
+  double allocsPerOp;
+  double bytesPerOp;
+  uint32_t out;
+  uint32_t samples;   // the samples out holds, 0 if that doesn't apply
+};
+
+typedef size_t (*benchFunction)();    // one call of the code being measured, returns the bytes it produced
+struct benchCase {
+  const char* name;
+  benchFunction run;
+};
+
+const uint32_t benchTargetUs = 50000;
+const int benchRepeats = 5;
+const double benchSlower = 0.25;      // slower than the baseline by more than this counts as a regression
+const size_t benchChunk = 1024;       // streams are read in pieces of this size, about what a chunked response asks for
+uint32_t benchSamples = 0;            // a case that stores or streams samples sets this to how many its out held
+volatile size_t benchSink;            // keeps the compiler from dropping calls whose result is otherwise unused
+
+// Inputs for the cases, made by benchSetup(). The ones that are read never change, the add cases have their own,
+// so every case sees the same data however many iterations the others ran.
+SampleHistory<NUM_TEMP_READINGS> benchHistory;
+SampleHistory<NUM_TEMP_READINGS> benchHistoryScratch;
+CompressedHistory<HISTORY_ARCHIVE_BLOCK_BYTES, 4> benchArchive;   // the archive's block size, but only a few blocks of RAM
+CompressedHistory<HISTORY_ARCHIVE_BLOCK_BYTES, 4> benchArchiveScratch;
+uint32_t benchArchiveSamples = 0;   // held by benchArchive
+HistoryTier<60> benchTier("bench", 60);
+uint32_t benchEpoch;
+uint8_t benchOut[benchChunk];
+
+// The history as it was before tempSample: a label formatted with strftime when the reading was taken, the
+// reading as a float, and a heap node per reading in a linked list (ListLinked then, std::list here)
+#ifdef ARDUINO
+typedef String legacyLabel;
+#else
+typedef std::string legacyLabel;
+#endif
+struct legacySample {
+  legacyLabel timeLabel;
+  float temp;
+};
+std::list<legacySample> benchLegacy;
+
+tempSample benchSample() {    // the next one of a steady heating curve, with a bit of wobble
+  benchEpoch += TEMP_READ_FREQ / 1000;
+  tempSample S = {benchEpoch, (int16_t)(2000 + (benchEpoch / 15) % 8000 + (benchEpoch % 7) * 3)};
+  return S;
+}
+
+std::vector<int16_t> benchRecordedC;    // the control probe every TEMP_READ_FREQ through the golden trace
+size_t benchRecordedNext = 0;
+
+void benchRecordedSetup() {
+  benchRecordedC.clear();
+  benchRecordedNext = 0;
+#ifndef ARDUINO
+  std::vector<recordedReading> readings = goldenReadings();
+  int64_t lastRead = 0;
+  for(size_t i = 0; i < readings.size(); i++) {
+    if(readings[i].probe == CONTROL_PROBE && (benchRecordedC.empty() || readings[i].atUs - lastRead >= TEMP_READ_FREQ * 1000LL)) {
+      benchRecordedC.push_back(toCentiC(readings[i].rawC));
+      lastRead = readings[i].atUs;
+    }
+  }
+  if(benchRecordedC.empty()) {
+    benchPrint("# can't read test/traces/golden.tbkt, the archive cases use benchSample()'s readings");
+  }
+#endif
+}
+
+tempSample benchRecorded() {    // the next recorded reading, over and over, or benchSample() without them
+  if(benchRecordedC.empty()) {
+    return benchSample();
+  }
+  benchEpoch += TEMP_READ_FREQ / 1000;
+  tempSample S = {benchEpoch, benchRecordedC[benchRecordedNext++ % benchRecordedC.size()]};
+  return S;
+}
+
+size_t benchLegacyAdd() {   // what storing a reading used to cost, history.add is the same with tempSample
+  tempSample S = benchSample();
+  time_t epoch = S.epoch;
+  struct tm t;
+  gmtime_r(&epoch, &t);
+  char timeStr[9];
+  strftime(timeStr, sizeof(timeStr), "%H:%M:%S", &t);
+  legacySample L;
+  L.timeLabel = timeStr;
+  L.temp = fromCentiC(S.centiC);
+  benchLegacy.push_back(L);
+  if(benchLegacy.size() > NUM_TEMP_READINGS) {
+    benchLegacy.pop_front();
+  }
+  return sizeof(legacySample);
+}
+
+size_t benchLegacyIterate() {
+  size_t n = 0;
+  for(std::list<legacySample>::const_iterator it = benchLegacy.begin(); it != benchLegacy.end(); ++it) {
+    n += it->temp != 0;
+  }
+  return n;
+}
+
+// The flash log cases each get a directory of their own under benchLogBase, benchLogCleanup() removes them again.
+// On the kettle that is on LittleFS, so they measure the real flash, and do nothing if it isn't mounted.
+#ifdef ARDUINO
+char benchLogBase[40] = "/littlefs/bench";
+#else
+char benchLogBase[40] = "/tmp/kettleBenchXXXXXX";
+#endif
+char benchLogDirs[3][48];   // batched, unbatched, recover
+HistoryLog<LOG_BATCH>* benchLog = NULL;
+HistoryLog<1>* benchLogUnbatched = NULL;
+
+void benchLogSetup() {
+#ifdef ARDUINO
+  mkdir(benchLogBase, 0755);
+#else
+  if(mkdtemp(benchLogBase) == NULL) {
+    return;
+  }
+#endif
+  for(int i = 0; i < 3; i++) {
+    snprintf(benchLogDirs[i], sizeof(benchLogDirs[i]), "%s/%d", benchLogBase, i);
+    mkdir(benchLogDirs[i], 0755);
+  }
+  benchLog = new HistoryLog<LOG_BATCH>(benchLogDirs[0], LOG_SEGMENTS, LOG_SEGMENT_RECORDS);
+  benchLog->recover([](const tempSample&){});
+  benchLogUnbatched = new HistoryLog<1>(benchLogDirs[1], LOG_SEGMENTS, LOG_SEGMENT_RECORDS);
+  benchLogUnbatched->recover([](const tempSample&){});
+
+  HistoryLog<LOG_BATCH> full(benchLogDirs[2], LOG_SEGMENTS, LOG_SEGMENT_RECORDS);   // the newest segment one short of full, the most recover() ever reads
+  full.recover([](const tempSample&){});
+  for(uint32_t i = 0; i + 1 < LOG_SEGMENT_RECORDS; i++) {
+    full.append(benchSample());
+  }
+  full.flush();
+}
+
+void benchLogCleanup() {
+  delete benchLog;
+  delete benchLogUnbatched;
+  benchLog = NULL;
+  benchLogUnbatched = NULL;
+  for(int i = 0; i < 3; i++) {
+    for(int s = 0; s < LOG_SEGMENTS; s++) {
+      char path[sizeof(benchLogDirs) + 16];   // as far as the compiler can tell, benchLogDirs[i] might run on into the next one
+      snprintf(path, sizeof(path), "%s/hist%d.log", benchLogDirs[i], s);
+      unlink(path);
+    }
+    rmdir(benchLogDirs[i]);
+  }
+  rmdir(benchLogBase);
+}
+
+void benchSetup() {
+  benchEpoch = 1690000000;
+  for(size_t i = 0; i < benchHistory.capacity(); i++) {
+    tempSample S = benchSample();
+    benchHistory.add(S);
+    benchHistoryScratch.add(S);
+  }
+  benchRecordedSetup();
+  for(int i = 0; i < 2000; i++) {   // more than the 4 blocks hold, so the oldest have been reused like on a kettle that has run a while
+    benchArchive.add(benchRecorded());
+  }
+  CompressedHistory<HISTORY_ARCHIVE_BLOCK_BYTES, 4>::cursor C(benchArchive);
+  tempSample S;
+  for(benchArchiveSamples = 0; C.next(S); benchArchiveSamples++) {}
+  benchLegacy.clear();
+  while(benchLegacy.size() < NUM_TEMP_READINGS) {
+    benchLegacyAdd();
+  }
+  benchLogSetup();
+}
+
+template<typename S>
+size_t benchDrain(S& stream) {
+  size_t total = 0;
+  size_t n;
+  while((n = stream.read(benchOut, sizeof(benchOut))) > 0) {
+    total += n;
+  }
+  return total;
+}
+
+size_t benchStatusJSON() {
+  char buf[statusJSONBytes];
+  return statusJSON(buf, sizeof(buf));
+}
+
+size_t benchTempsJSON() {
+  TempsJSONStream<SampleHistory<NUM_TEMP_READINGS> > temps(benchHistory);
+  return benchDrain(temps);
+}
+
+size_t benchIsKettleFull() {
+  return isKettleFull();
+}
+
+size_t benchSampleFrame() {
+  char buf[64];
+  tempSample S = {benchEpoch, 9876};
+  return sampleFrameJSON(buf, sizeof(buf), S);
+}
+
+size_t benchAckFrame() {
+  char buf[128];
+  commandAck A = {CMD_FILL_AND_HEAT, 123456, true, false, 4321};
+  return ackFrameJSON(buf, sizeof(buf), A);
+}
+
+size_t benchHistoryAdd() {    // the history is full, so every add also drops the oldest
+  benchHistoryScratch.add(benchSample());
+  return sizeof(tempSample);
+}
+
+size_t benchHistoryIterate() {
+  SampleHistory<NUM_TEMP_READINGS>::cursor C(benchHistory);
+  tempSample S;
+  size_t n = 0;
+  while(C.next(S)) {
+    n += S.centiC != 0;
+  }
+  return n;
+}
+
+size_t benchArchiveAdd() {    // blocks get sealed and reused along the way, like the real archive
+  benchArchiveScratch.add(benchRecorded());
+  return sizeof(tempSample);
+}
+
+// Decodes the whole archive. out is the RAM it takes, so B/sample is what a reading costs in the archive.
+size_t benchArchiveIterate() {
+  CompressedHistory<HISTORY_ARCHIVE_BLOCK_BYTES, 4>::cursor C(benchArchive);
+  tempSample S;
+  size_t n = 0;
+  int32_t sum = 0;
+  while(C.next(S)) {
+    n++;
+    sum += S.centiC;
+  }
+  benchSink = sum;    // or the decoding of the values could be left out
+  benchSamples = n;
+  return benchArchive.bytes();
+}
+
+// The whole archive as /api/history.bin sends it, in either format, and as /history sends it in JSON
+size_t benchExportBin() {
+  BinaryHistoryStream<CompressedHistory<HISTORY_ARCHIVE_BLOCK_BYTES, 4> > stream(benchArchive, TEMP_READ_FREQ / 1000, 0, false);
+  benchSamples = benchArchiveSamples;
+  return benchDrain(stream);
+}
+
+size_t benchExportCbor() {
+  BinaryHistoryStream<CompressedHistory<HISTORY_ARCHIVE_BLOCK_BYTES, 4> > stream(benchArchive, TEMP_READ_FREQ / 1000, 0, true);
+  benchSamples = benchArchiveSamples;
+  return benchDrain(stream);
+}
+
+size_t benchExportJSON() {
+  BucketsJSONStream<CompressedHistory<HISTORY_ARCHIVE_BLOCK_BYTES, 4> > stream(benchArchive, "raw", TEMP_READ_FREQ / 1000, 0);
+  benchSamples = benchArchiveSamples;
+  return benchDrain(stream);
+}
+
+size_t benchTierAdd() {
+  benchTier.add(benchSample());
+  return sizeof(tempSample);
+}
+
+// One batch of LOG_BATCH readings into the flash log, the write and the fsync() included. out is what the
+// batch puts on flash, against the LOG_BATCH * 6 bytes of the samples themselves.
+size_t benchLogBatch() {
+  if(benchLog == NULL) {
+    return 0;
+  }
+  for(int i = 0; i < LOG_BATCH; i++) {
+    benchLog->append(benchSample());
+  }
+  return LOG_BATCH * HistoryLog<LOG_BATCH>::recordBytes();
+}
+
+size_t benchLogUnbatchedBatch() {   // the same readings with an fsync() each, what batching saves
+  if(benchLogUnbatched == NULL) {
+    return 0;
+  }
+  for(int i = 0; i < LOG_BATCH; i++) {
+    benchLogUnbatched->append(benchSample());
+  }
+  return LOG_BATCH * HistoryLog<1>::recordBytes();
+}
+
+size_t benchLogRecover() {    // what setup() does with the log at boot, into the scratch copies of the history
+  HistoryLog<LOG_BATCH> L(benchLogDirs[2], LOG_SEGMENTS, LOG_SEGMENT_RECORDS);
+  return L.recover([](const tempSample& S){
+    benchHistoryScratch.add(S);
+    benchArchiveScratch.add(S);
+    benchTier.add(S);
+  });
+}
+
+#if PHASE_TIMING
+size_t benchPhaseTime() {   // what PHASE_TIME() adds to every phase it times, into loop()'s, which runBenchmarks() clears again
+  PHASE_TIME(PHASE_LOOP);
+  return 0;
+}
+#endif
+
+#ifndef ARDUINO
+size_t benchControlStep() {   // a whole idle control period, only on the PC, on the kettle it would drive the hardware
+  nativeHw.nowUs += CONTROL_PERIOD_MS * 1000;
+  controlStep();
+  return 0;
+}
+#endif
+
+const benchCase benchCases[] = {
+  {"statusJSON", benchStatusJSON},
+  {"tempsJSON", benchTempsJSON},
+  {"isKettleFull", benchIsKettleFull},
+  {"ws.sampleFrame", benchSampleFrame},
+  {"ws.ackFrame", benchAckFrame},
+  {"history.add", benchHistoryAdd},
+  {"history.iterate", benchHistoryIterate},
+  {"legacy.add", benchLegacyAdd},
+  {"legacy.iterate", benchLegacyIterate},
+  {"archive.add", benchArchiveAdd},
+  {"archive.iterate", benchArchiveIterate},
+  {"export.bin", benchExportBin},
+  {"export.cbor", benchExportCbor},
+  {"export.json", benchExportJSON},
+  {"tier.add", benchTierAdd},
+  {"log.batch", benchLogBatch},
+  {"log.unbatched", benchLogUnbatchedBatch},
+  {"log.recover", benchLogRecover},
+#if PHASE_TIMING
+  {"phase.time", benchPhaseTime},
+#endif
+#ifndef ARDUINO
+  {"controlStep", benchControlStep},
+#endif
+};
+const size_t benchCaseCount = sizeof(benchCases) / sizeof(benchCases[0]);
+
+struct benchRun {
+  uint64_t ns;
+  benchCycleCount cycles;
+  uint32_t allocs;
+  uint32_t allocBytes;
+};
+
+benchRun benchTime(const benchCase& C, uint32_t n) {
+  benchRun R;
+  R.allocs = benchAllocs;
+  R.allocBytes = benchAllocBytes;
+  R.cycles = benchCycles();
+  uint64_t started = benchNowNs();
+  size_t sink = 0;
+  for(uint32_t i = 0; i < n; i++) {
+    sink += C.run();
+  }
+  R.ns = benchNowNs() - started;
+  R.cycles = benchCycles() - R.cycles;
+  R.allocs = benchAllocs - R.allocs;
+  R.allocBytes = benchAllocBytes - R.allocBytes;
+  benchSink = sink;
+  return R;
+}
+
+benchResult benchMeasure(const benchCase& C) {
+  benchResult R;
+  memset(&R, 0, sizeof(R));
+  strncpy(R.name, C.name, sizeof(R.name) - 1);
+  benchSamples = 0;
+  R.out = C.run();    // warm up, and the output size
+  R.samples = benchSamples;
+  uint32_t n = 1;
+  benchRun best = benchTime(C, n);
+  while(best.ns < benchTargetUs * 1000ULL && n < (1u << 30)) {
+    n *= 2;
+    best = benchTime(C, n);
+  }
+  uint32_t allocs = best.allocs;    // allocations are taken from the worst run, an occasional one still counts
+  uint32_t allocBytes = best.allocBytes;
+  for(int i = 0; i < benchRepeats; i++) {
+    benchRun run = benchTime(C, n);
+    if(run.ns < best.ns) {
+      best = run;
+    }
+    if(run.allocs > allocs) {
+      allocs = run.allocs;
+      allocBytes = run.allocBytes;
+    }
+  }
+  R.iterations = n;
+  R.nsPerOp = (double)best.ns / n;
+  R.cyclesPerOp = (double)best.cycles / n;
+  R.allocsPerOp = (double)allocs / n;
+  R.bytesPerOp = (double)allocBytes / n;
+  return R;
+}
+
+int benchFormat(char* buf, size_t len, const benchResult& R) {
+  int n = snprintf(buf, len, "%-18s %10u %12.1f %12.1f %9.2f %9.1f %7u", R.name, (unsigned)R.iterations, R.nsPerOp, R.cyclesPerOp, R.allocsPerOp, R.bytesPerOp, (unsigned)R.out);
+  if(R.samples > 0 && n > 0 && (size_t)n < len) {
+    n += snprintf(buf + n, len - n, " %9.2f", (double)R.out / R.samples);
+  }
+  return n;
+}
+
+const char* benchHeader = "# name             iterations        ns/op    cycles/op allocs/op      B/op     out  B/sample";
+
+// Runs every case and prints a line for each, returns how many ran. On the kettle this must be before the control
+// task is started, isKettleFull() and controlStep() belong to it.
+size_t runBenchmarks(benchResult* results = NULL) {
+  benchSetup();
+  benchPrint(benchHeader);
+  for(size_t i = 0; i < benchCaseCount; i++) {
+    benchResult R = benchMeasure(benchCases[i]);
+    char line[128];
+    benchFormat(line, sizeof(line), R);
+    benchPrint(line);
+    if(results != NULL) {
+      results[i] = R;
+    }
+  }
+#if PHASE_TIMING
+  phaseTimes[PHASE_LOOP].reset();
+#endif
+  benchLogCleanup();
+  return benchCaseCount;
+}
+
+// Reads one line of a baseline file, false for comments and anything that doesn't parse
+bool benchParse(const char* line, benchResult& R) {
+  memset(&R, 0, sizeof(R));
+  if(line[0] == '#') {
+    return false;
+  }
+  unsigned iterations, out;
+  if(sscanf(line, "%23s %u %lf %lf %lf %lf %u", R.name, &iterations, &R.nsPerOp, &R.cyclesPerOp, &R.allocsPerOp, &R.bytesPerOp, &out) != 7) {
+    return false;
+  }
+  R.iterations = iterations;
+  R.out = out;
+  return true;
+}
+
+// Compares a result with its baseline, writes a note into buf. Returns true if it is a regression.
+bool benchCompare(const benchResult& now, const benchResult& base, char* buf, size_t len) {
+  double change = base.nsPerOp > 0 ? now.nsPerOp / base.nsPerOp - 1 : 0;
+  bool slower = change > benchSlower;
+  bool allocates = now.allocsPerOp > base.allocsPerOp + 0.005 || now.bytesPerOp > base.bytesPerOp + 0.5;
+  snprintf(buf, len, "%-18s %+6.1f%% time%s%s", now.name, change * 100, slower ? "  SLOWER" : "", allocates ? "  ALLOCATES MORE" : "");
+  return slower || allocates;
+}
+
+#endif
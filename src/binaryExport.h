@@ -0,0 +1,177 @@
+/*
+    Compact binary export of the temperature history, for pulling a lot of history off a lot of kettles.
+
+    Format (version 1, all multi-byte fields little endian):
+      header, 8 bytes:   "TBKH"  version (1 byte)  flags (1 byte, 0)  nominal seconds between samples (uint16)
+      then per sample:   seconds since the previous sample (the first one: since 1970) as an unsigned LEB128
+                         varint, followed by the temperature in centi-degrees as an int16
+    There is no count or end marker, the samples simply run to the end of the data. A steady 15 second
+    sample is 3 bytes, compared to about 45 for the same sample in the JSON history.
+
+    The CBOR variant is an indefinite length array of [epoch, centi-degrees] pairs, for tools that would
+    rather use a generic decoder.
+
+    BinaryHistoryStream writes either form a piece at a time like the JSON streams. decodeBinaryHistory()
+    reads the TBKH form back and is shared with the PC side converter in tools/.
+*/
+
+#ifndef BINARY_EXPORT
+#define BINARY_EXPORT
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "tempSample.h"
+#include "pendingStream.h"
+
+#define BINARY_HISTORY_VERSION 1
+
+// H is anything with a cursor: SampleHistory or CompressedHistory
+template<typename H>
+class BinaryHistoryStream : public PendingStream<BinaryHistoryStream<H>, 16, uint8_t> {
+  typedef PendingStream<BinaryHistoryStream<H>, 16, uint8_t> pending;   // one sample at most
+  friend pending;
+  using pending::_pending;
+  using pending::_len;
+  using pending::_pos;
+
+public:
+  BinaryHistoryStream(const H& history, uint16_t width, uint32_t since, bool cbor) : _cursor(history, since), _width(width), _since(since), _cbor(cbor),
+    _stage(STAGE_OPEN), _lastEpoch(0) {}
+
+private:
+  enum stages {
+    STAGE_OPEN,
+    STAGE_SAMPLES,
+    STAGE_CLOSE,
+    STAGE_DONE
+  };
+
+  bool refill() {
+    _pos = 0;
+    _len = 0;
+    switch(_stage) {
+      case STAGE_OPEN:
+        if(_cbor) {
+          _pending[_len++] = 0x9F;    // start of an indefinite length array
+        } else {
+          memcpy(_pending, "TBKH", 4);
+          _len = 4;
+          _pending[_len++] = BINARY_HISTORY_VERSION;
+          _pending[_len++] = 0;
+          _pending[_len++] = _width & 0xFF;
+          _pending[_len++] = _width >> 8;
+        }
+        _stage = STAGE_SAMPLES;
+        return true;
+      case STAGE_SAMPLES: {
+        tempSample S;
+        while(_cursor.next(S)) {
+          if(S.epoch < _since) {
+            continue;
+          }
+          if(_cbor) {
+            _pending[_len++] = 0x82;    // array of 2
+            cborInt(S.epoch);
+            cborInt(S.centiC);
+          } else {
+            uint32_t delta = S.epoch - _lastEpoch;
+            do {
+              uint8_t b = delta & 0x7F;
+              delta >>= 7;
+              _pending[_len++] = delta ? (b | 0x80) : b;
+            } while(delta);
+            _pending[_len++] = (uint16_t)S.centiC & 0xFF;
+            _pending[_len++] = (uint16_t)S.centiC >> 8;
+          }
+          _lastEpoch = S.epoch;
+          return true;
+        }
+        _stage = STAGE_CLOSE;
+        return refill();
+      }
+      case STAGE_CLOSE:
+        _stage = STAGE_DONE;
+        if(_cbor) {
+          _pending[_len++] = 0xFF;    // "break", ends the indefinite length array
+          return true;
+        }
+        return false;
+      case STAGE_DONE:
+      default:
+        return false;
+    }
+  }
+
+  void cborInt(int32_t v) {   // smallest CBOR encoding of an integer
+    uint8_t major = 0x00;
+    uint32_t u = v;
+    if(v < 0) {
+      major = 0x20;
+      u = -1 - v;
+    }
+    if(u < 24) {
+      _pending[_len++] = major | u;
+    } else if(u <= 0xFF) {
+      _pending[_len++] = major | 24;
+      _pending[_len++] = u;
+    } else if(u <= 0xFFFF) {
+      _pending[_len++] = major | 25;
+      _pending[_len++] = u >> 8;
+      _pending[_len++] = u & 0xFF;
+    } else {
+      _pending[_len++] = major | 26;
+      _pending[_len++] = u >> 24;
+      _pending[_len++] = (u >> 16) & 0xFF;
+      _pending[_len++] = (u >> 8) & 0xFF;
+      _pending[_len++] = u & 0xFF;
+    }
+  }
+
+  typename H::cursor _cursor;
+  uint16_t _width;
+  uint32_t _since;
+  bool _cbor;
+  stages _stage;
+  uint32_t _lastEpoch;
+};
+
+// Calls sample(const tempSample&) for every sample in a TBKH export. Returns the number of samples, or -1 if
+// the header is wrong or the data ends part way through a sample. width is set to the nominal sample spacing.
+template<typename F>
+long decodeBinaryHistory(const uint8_t* data, size_t len, uint16_t& width, F sample) {
+  if(len < 8 || memcmp(data, "TBKH", 4) != 0 || data[4] != BINARY_HISTORY_VERSION) {
+    return -1;
+  }
+  width = data[6] | (data[7] << 8);
+  size_t pos = 8;
+  long count = 0;
+  uint32_t epoch = 0;
+  while(pos < len) {
+    uint32_t delta = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+      if(pos >= len || shift > 28) {
+        return -1;
+      }
+      b = data[pos++];
+      delta |= (uint32_t)(b & 0x7F) << shift;
+      shift += 7;
+    } while(b & 0x80);
+    if(pos + 2 > len) {
+      return -1;
+    }
+    epoch += delta;
+    tempSample S;
+    S.epoch = epoch;
+    S.centiC = (int16_t)(data[pos] | (data[pos + 1] << 8));
+    pos += 2;
+    sample(S);
+    count++;
+  }
+  return count;
+}
+
+#endif
@@ -0,0 +1,268 @@
+/*
+    Compressed long term archive of raw temperature samples.
+
+    Readings come in at a steady TEMP_READ_FREQ and the water temperature changes slowly, so both the
+    timestamps and the values compress very well (the same idea as Facebook's Gorilla time series store):
+    - timestamps are stored as the change in the gap between samples (delta of delta), which is 0 and costs
+      one bit as long as readings arrive on schedule
+    - values are stored as the change from the previous value in centi-degrees, which is 0 or small
+    both with a short prefix saying how many bits follow. A steady sample costs 2 bits instead of 6 bytes.
+
+    Samples are packed into fixed size blocks. The first sample of a block is stored as is in the header so
+    every block can be decoded on its own. When the next sample won't fit the block is sealed and the next one
+    started, and once all Blocks are used the oldest block is reused.
+
+    Like SampleHistory, add() must only be called from one task and readers (through cursor) never lock. A
+    reader that was decoding a block when it got reused notices and skips ahead to the oldest block still held.
+*/
+
+#ifndef COMPRESSED_HISTORY
+#define COMPRESSED_HISTORY
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+#include "tempSample.h"
+
+template<size_t BlockBytes, size_t Blocks>
+class CompressedHistory {
+  static_assert(BlockBytes >= 16, "CompressedHistory blocks are too small to be useful");
+  static_assert(Blocks > 1, "CompressedHistory needs at least two blocks");
+  static_assert(BlockBytes * 4 < 65535, "CompressedHistory blocks could hold more samples than count can track");
+
+  struct block {
+    uint32_t firstEpoch;
+    int16_t firstC;
+    std::atomic<uint16_t> count;    // samples in the block including the first one
+    uint8_t data[BlockBytes];
+  };
+
+public:
+  typedef tempSample item;
+
+  CompressedHistory() : _claimed(0), _started(0), _bits(0), _lastEpoch(0), _lastGap(0), _lastC(0) {}
+
+  static constexpr size_t bytes() { return sizeof(block) * Blocks; }
+
+  // Only ever call from one task at a time
+  void add(const tempSample& S) {
+    if(_started.load(std::memory_order_relaxed) == 0) {
+      startBlock(S);
+      return;
+    }
+    block& B = current();
+    int32_t gap = (int32_t)(S.epoch - _lastEpoch);
+    uint32_t gapCode = zigzag(gap - _lastGap);
+    uint32_t valueCode = zigzag((int32_t)S.centiC - _lastC);
+    if(_bits + gapBits(gapCode) + valueBits(valueCode) > BlockBytes * 8) {
+      startBlock(S);    // current block is sealed from here on
+      return;
+    }
+    writeGap(B, gapCode);
+    writeValue(B, valueCode);
+    _lastGap = gap;
+    _lastEpoch = S.epoch;
+    _lastC = S.centiC;
+    B.count.store(B.count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Reads samples oldest first. Anything added after the cursor was made is left out.
+  class cursor {
+  public:
+    // Whole blocks that end before since are skipped without decoding them. Samples before since in the
+    // first block that is decoded are still returned, the caller should filter those.
+    cursor(const CompressedHistory& history, uint32_t since = 0) : _h(&history), _end(history._started.load(std::memory_order_acquire)), _idx(0), _bit(0) {
+      _block = _h->oldest();
+      while(_block + 1 < _end) {
+        uint32_t nextStart = _h->slot(_block + 1).firstEpoch;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(!_h->stillHeld(_block + 1) || nextStart > since) {
+          break;
+        }
+        _block++;
+      }
+    }
+
+    bool next(tempSample& out) {
+      while(_block < _end) {
+        if(!_h->stillHeld(_block)) {
+          restart();
+          continue;
+        }
+        const block& B = _h->slot(_block);
+        uint16_t count = B.count.load(std::memory_order_acquire);
+        if(_idx >= count) {
+          if(_block + 1 == _end) {
+            return false;   // newest block, nothing more in it yet
+          }
+          _block++;
+          _idx = 0;
+          continue;
+        }
+        if(_idx == 0) {
+          _epoch = B.firstEpoch;
+          _c = B.firstC;
+          _gap = 0;
+          _bit = 0;
+        } else {
+          _gap += unzigzag(readGap(B));
+          _epoch += _gap;
+          _c += unzigzag(readValue(B));
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(!_h->stillHeld(_block)) {
+          restart();    // the block got reused while we were decoding it, what we read is garbage
+          continue;
+        }
+        _idx++;
+        out.epoch = _epoch;
+        out.centiC = (int16_t)_c;
+        return true;
+      }
+      return false;
+    }
+
+  private:
+    void restart() {
+      _block = _h->oldest();
+      _idx = 0;
+    }
+
+    uint32_t readBits(const block& B, int n) {
+      uint32_t v = 0;
+      while(n--) {
+        v = (v << 1) | ((B.data[_bit >> 3] >> (7 - (_bit & 7))) & 1);
+        _bit++;
+      }
+      return v;
+    }
+
+    int prefix(const block& B, int max) {   // counts leading 1 bits, up to max
+      int n = 0;
+      while(n < max && readBits(B, 1)) {
+        n++;
+      }
+      return n;
+    }
+
+    uint32_t readGap(const block& B) {
+      static const int widths[] = {0, 7, 9, 12, 32};
+      return readBits(B, widths[prefix(B, 4)]);
+    }
+
+    uint32_t readValue(const block& B) {
+      static const int widths[] = {0, 6, 9, 17};
+      return readBits(B, widths[prefix(B, 3)]);
+    }
+
+    const CompressedHistory* _h;
+    uint32_t _block;    // block sequence number being decoded
+    uint32_t _end;      // blocks started when the cursor was made
+    uint16_t _idx;      // samples of the block already returned
+    uint32_t _bit;      // read position in the block
+    uint32_t _epoch;
+    int32_t _gap;
+    int32_t _c;
+  };
+
+  // Epoch of the oldest sample still held, 0 if there is none
+  uint32_t oldestEpoch() const {
+    if(_started.load(std::memory_order_acquire) == 0) {
+      return 0;
+    }
+    uint32_t b = oldest();
+    uint32_t epoch = slot(b).firstEpoch;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return stillHeld(b) ? epoch : slot(oldest()).firstEpoch;    // if it just got reused the next one is the oldest now
+  }
+
+private:
+  static uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+  static int32_t unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+  // Prefix + payload sizes, keep these in step with cursor::readGap()/readValue()
+  static int gapBits(uint32_t code) {
+    if(code == 0) return 1;
+    if(code < (1u << 7)) return 2 + 7;
+    if(code < (1u << 9)) return 3 + 9;
+    if(code < (1u << 12)) return 4 + 12;
+    return 4 + 32;
+  }
+
+  static int valueBits(uint32_t code) {
+    if(code == 0) return 1;
+    if(code < (1u << 6)) return 2 + 6;
+    if(code < (1u << 9)) return 3 + 9;
+    return 3 + 17;
+  }
+
+  void writeBits(block& B, uint32_t v, int n) {
+    while(n--) {
+      if((v >> n) & 1) {
+        B.data[_bits >> 3] |= 0x80 >> (_bits & 7);
+      }
+      _bits++;
+    }
+  }
+
+  void writeGap(block& B, uint32_t code) {
+    switch(gapBits(code)) {
+      case 1: writeBits(B, 0, 1); break;
+      case 9: writeBits(B, 0x2, 2); writeBits(B, code, 7); break;
+      case 12: writeBits(B, 0x6, 3); writeBits(B, code, 9); break;
+      case 16: writeBits(B, 0xE, 4); writeBits(B, code, 12); break;
+      default: writeBits(B, 0xF, 4); writeBits(B, code, 32); break;
+    }
+  }
+
+  void writeValue(block& B, uint32_t code) {
+    switch(valueBits(code)) {
+      case 1: writeBits(B, 0, 1); break;
+      case 8: writeBits(B, 0x2, 2); writeBits(B, code, 6); break;
+      case 12: writeBits(B, 0x6, 3); writeBits(B, code, 9); break;
+      default: writeBits(B, 0x7, 3); writeBits(B, code, 17); break;
+    }
+  }
+
+  void startBlock(const tempSample& S) {
+    uint32_t seq = _started.load(std::memory_order_relaxed);
+    _claimed.store(seq + 1, std::memory_order_relaxed);   // readers of the block that used this slot before will notice
+    std::atomic_thread_fence(std::memory_order_release);
+    block& B = _blocks[seq % Blocks];
+    B.count.store(1, std::memory_order_relaxed);
+    B.firstEpoch = S.epoch;
+    B.firstC = S.centiC;
+    memset(B.data, 0, sizeof(B.data));
+    _bits = 0;
+    _lastEpoch = S.epoch;
+    _lastGap = 0;
+    _lastC = S.centiC;
+    _started.store(seq + 1, std::memory_order_release);
+  }
+
+  block& current() { return _blocks[(_started.load(std::memory_order_relaxed) - 1) % Blocks]; }
+  const block& slot(uint32_t seq) const { return _blocks[seq % Blocks]; }
+
+  uint32_t oldest() const {
+    uint32_t started = _started.load(std::memory_order_acquire);
+    return started > Blocks ? started - Blocks : 0;
+  }
+
+  // True if block seq has not been reused since it was started
+  bool stillHeld(uint32_t seq) const {
+    return _claimed.load(std::memory_order_relaxed) - seq <= Blocks;
+  }
+
+  block _blocks[Blocks];
+  std::atomic<uint32_t> _claimed;   // _started + 1 while startBlock() is resetting a slot
+  std::atomic<uint32_t> _started;   // blocks ever started, the newest one is still being filled
+  // writer only
+  uint32_t _bits;       // bits used in the current block
+  uint32_t _lastEpoch;
+  int32_t _lastGap;
+  int32_t _lastC;
+};
+
+#endif
@@ -18,17 +18,49 @@ const int   daylightOffset_sec =    3600;
 // Temperature settings (all Celcius)
 const float targetPreheat =         60.0;
 const float targetTemp =            100.0;
+#define MAX_PROBES                  2           // DS18B20 probes used on the OneWire bus, they are found at boot
+#define PROBE_NAMES                 {"bottom", "spout"}   // names for the probes, in address order (the order the bus search finds them)
+#define CONTROL_PROBE               0           // the probe that decides when the heat goes off
+#define TEMP_MEDIAN                 3           // Readings are the median of this many (odd) raw readings, then smoothed
+#define TEMP_MAX_SLEW               5.0         // A reading that moves faster than this many degrees per second is treated as a sensor fault
+#define TEMP_STUCK_MS               120000      // as is one that does not change at all for this long while heating
+#define TEMP_IDLE_PERIOD_MS         1000        // Time between temperature conversions while the heat is off (it runs flat out while heating)
+#define TEMP_FINE_BAND              5.0         // Within this many degrees of targetTemp the sensor runs at its full 12 bit resolution
+#define TEMP_FINE_ETA_S             30          // and also whenever the current heating rate would get there within this many seconds
 #define TEMP_READ_FREQ              15000       // The temperature reading is stored once every this many ms
-#define NUM_TEMP_READINGS           30
+#define NUM_TEMP_READINGS           30          // Each stored reading only costs 6 bytes of RAM
+#define HISTORY_ARCHIVE_BLOCK_BYTES 512         // Every reading is also kept compressed (usually 1-2 bytes each) in blocks of this size
+#define HISTORY_ARCHIVE_BLOCKS      64          // 32KB holds about a week of readings, 128 blocks (64KB) doubles that if you have the RAM
+#define HISTORY_MINUTE_BUCKETS      1440        // Longer term history, rolled up into 1 minute buckets (24 hours, 12 bytes each)
+#define HISTORY_QUARTER_BUCKETS     2880        // and 15 minute buckets (30 days, 12 bytes each)
+#define LOG_SEGMENTS                8           // Readings are also saved to flash in this many files that are reused in turn
+#define LOG_SEGMENT_RECORDS         1024        // readings per file (10 bytes each), the newest file is reloaded at boot
+#define LOG_BATCH                   20          // readings collected before writing to flash (fewer writes, but up to this many lost on a power cut)
 
-const float timeoutPump =           300000;     // maximum runtime of pump in milliseconds (safety cutoff)
-const float timeoutHeat =           540000;     // maximum runtime of kettle in milliseconds (the builtin functionality of the kettle should render this useless, but better safe than sorry)
+const uint32_t timeoutPump =        300000;     // maximum runtime of pump in milliseconds (safety cutoff)
+const uint32_t timeoutHeat =        540000;     // maximum runtime of kettle in milliseconds (the builtin functionality of the kettle should render this useless, but better safe than sorry)
+
+// Control loop settings
+// The pump/heat/temperature logic runs in its own task at a fixed rate. The web server runs on the other core.
+#define CONTROL_PERIOD_MS           10          // how often the control logic runs
+#define CONTROL_CORE                1           // keep this off the core set by CONFIG_ASYNC_TCP_RUNNING_CORE in platformio.ini
+#define CONTROL_PRIORITY            3           // above the Arduino loop task (1) so housekeeping never delays it
+#define TRACE_SEGMENT_BYTES         4096        // The control logic's inputs and decisions are recorded in RAM for replaying on a PC (/api/trace),
+#define TRACE_SEGMENTS              4           // in this many segments of that size. 16KB holds about 20 minutes idle or 3 of heating, 0 turns it off
+#define PHASE_TIMING                1           // time every phase of the control step and loop() (/api/timing), 0 compiles it out
+
+// Web settings
+// Status changes are pushed to the WebSocket clients as they happen, these keep that from flooding them
+#define WS_MIN_INTERVAL_MS          250         // at most one status push every this many ms, changes in between are combined
+#define WS_REFRESH_MS               5000        // push the status at least this often even if nothing changed
+#define WS_TEMP_DELTA               10          // temperature change (in hundredths of a degree C) that counts as a change
 
 // Servo positions for the kettle arm
 // You may have to tweak these values as your kettle, servo, and mount may effect them
 #define KETTLE_ON 74
 #define KETTLE_NEUTRAL 50
 #define KETTLE_OFF 32
+#define KETTLE_PRESS_MS 250     // How long the arm holds a position before returning to neutral
 
 // OTA settings
 #define OTA_ID          "TBK1"
@@ -0,0 +1,240 @@
+/*
+    Trace of everything the control logic took in and put out, for replaying a kettle's behaviour on a PC.
+
+    Recorded by kettleControl.h into a TraceRing in RAM, downloaded from /api/trace and replayed by the native
+    build (program replay file). Only the inputs are needed to replay: the control step times, the probe
+    readings, the float switch and the commands from the web side. The outputs (pump relay and arm) are
+    recorded as well so the replay can check it made the same decisions at the same steps.
+
+    The ring is made of segments like CompressedHistory's blocks. Every segment starts with a keyframe holding
+    the control state at the start of a step, so a replay can start from whichever segment is the oldest one
+    still held, and a segment that gets reused while it is being downloaded is simply left out.
+
+    Download format (version 1, all multi-byte fields little endian):
+      header, 8 bytes:   "TBKT"  version (1 byte)  CONTROL_PERIOD_MS (1 byte)  MAX_PROBES (1 byte)  TEMP_MEDIAN (1 byte)
+      then per segment:  length (uint16) and that many bytes of records, oldest segment first
+    Records, a type byte (low 4 bits, the high 4 bits are type specific) then:
+      TRACE_KEYFRAME   step (uint32), time (int64, µs since boot), epoch (uint32), flags (TRACE_CONTINUES if
+                       nothing was lost since the previous segment), then the state as written by traceSnapshot()
+      TRACE_STEP       steps since the last STEP or KEYFRAME (varint), µs off the control period since then
+                       (zigzag varint). Steps where nothing was recorded are left out, they ran on schedule.
+      TRACE_PROBE      high bits the probe, the raw reading in 1/128 degrees (int16), as DallasTemperature reports it
+      TRACE_FLOAT      high bits level | cut << 1, µs from the step to the last edge (zigzag varint). Only when it changed.
+      TRACE_COMMAND    high bits the command, id (varint), µs it waited in the queue (varint)
+      TRACE_PUMP       high bits the new relay state
+      TRACE_ARM        angle (varint)
+    Everything but the keyframe belongs to the step in the last TRACE_STEP (or the keyframe).
+*/
+
+#ifndef CONTROL_TRACE
+#define CONTROL_TRACE
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+#include "pendingStream.h"
+
+#define CONTROL_TRACE_VERSION 1
+
+enum traceRecordType {
+  TRACE_KEYFRAME,
+  TRACE_STEP,
+  TRACE_PROBE,
+  TRACE_FLOAT,
+  TRACE_COMMAND,
+  TRACE_PUMP,
+  TRACE_ARM
+};
+
+#define TRACE_CONTINUES 0x01
+
+// Builds one record at a time on the stack before it goes into the ring, a keyframe needs a bigger one
+template<size_t Bytes = 64>
+struct tracePacker {
+  uint8_t buf[Bytes];
+  size_t len;
+
+  tracePacker() : len(0) {}
+
+  void u8(uint8_t v) {
+    if(len < sizeof(buf)) {
+      buf[len++] = v;
+    }
+  }
+  void u16(uint16_t v) { u8(v); u8(v >> 8); }
+  void u32(uint32_t v) { u16(v); u16(v >> 16); }
+  void u64(uint64_t v) { u32(v); u32(v >> 32); }
+  void f32(float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    u32(bits);
+  }
+  void varint(uint32_t v) {
+    while(v >= 0x80) {
+      u8(v | 0x80);
+      v >>= 7;
+    }
+    u8(v);
+  }
+  void zigzag(int32_t v) { varint(((uint32_t)v << 1) ^ (uint32_t)(v >> 31)); }
+  bool full() const { return len >= sizeof(buf); }   // something did not fit, the record is broken
+};
+
+// Reads records back, ok() turns false once anything ran past the end
+struct traceUnpacker {
+  const uint8_t* p;
+  const uint8_t* end;
+  bool good;
+
+  traceUnpacker(const uint8_t* data, size_t len) : p(data), end(data + len), good(true) {}
+
+  bool ok() const { return good; }
+  bool done() const { return p >= end; }
+  uint8_t u8() {
+    if(p >= end) {
+      good = false;
+      return 0;
+    }
+    return *p++;
+  }
+  uint16_t u16() { uint16_t lo = u8(); return lo | (uint16_t)u8() << 8; }
+  uint32_t u32() { uint32_t lo = u16(); return lo | (uint32_t)u16() << 16; }
+  uint64_t u64() { uint64_t lo = u32(); return lo | (uint64_t)u32() << 32; }
+  float f32() {
+    uint32_t bits = u32();
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+  }
+  uint32_t varint() {
+    uint32_t v = 0;
+    for(int shift = 0; shift < 35; shift += 7) {
+      uint8_t b = u8();
+      v |= (uint32_t)(b & 0x7F) << shift;
+      if(!(b & 0x80)) {
+        break;
+      }
+    }
+    return v;
+  }
+  int32_t zigzag() {
+    uint32_t v = varint();
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+  }
+};
+
+// append() must only be called from one task. Readers copy whole segments out with copySegment() and never lock.
+template<size_t SegmentBytes, size_t Segments>
+class TraceRing {
+  static_assert(SegmentBytes >= 512 && SegmentBytes < 65536, "TraceRing segments need room for a keyframe and a uint16 length");
+  static_assert(Segments > 1, "TraceRing needs at least two segments");
+
+  struct segment {
+    std::atomic<uint16_t> len;
+    uint8_t data[SegmentBytes];
+  };
+
+public:
+  TraceRing() : _claimed(0), _started(0) {}
+
+  static constexpr size_t segmentBytes() { return SegmentBytes; }
+
+  // Starts a new segment, reusing the oldest one once they are all used
+  void startSegment() {
+    uint32_t seq = _started.load(std::memory_order_relaxed);
+    _claimed.store(seq + 1, std::memory_order_relaxed);   // readers copying the segment that used this slot will notice
+    std::atomic_thread_fence(std::memory_order_release);
+    _segments[seq % Segments].len.store(0, std::memory_order_relaxed);
+    _started.store(seq + 1, std::memory_order_release);
+  }
+
+  size_t room() const {   // free bytes in the current segment, 0 before the first startSegment()
+    if(_started.load(std::memory_order_relaxed) == 0) {
+      return 0;
+    }
+    return SegmentBytes - current().len.load(std::memory_order_relaxed);
+  }
+
+  bool append(const uint8_t* data, size_t len) {
+    if(len > room()) {
+      return false;
+    }
+    segment& S = current();
+    uint16_t used = S.len.load(std::memory_order_relaxed);
+    memcpy(S.data + used, data, len);
+    S.len.store(used + len, std::memory_order_release);
+    return true;
+  }
+
+  uint32_t started() const { return _started.load(std::memory_order_acquire); }   // segments ever started
+  uint32_t oldest() const {
+    uint32_t started = _started.load(std::memory_order_acquire);
+    return started > Segments ? started - Segments : 0;
+  }
+
+  // Copies segment seq (a number between oldest() and started() - 1) into out, which needs SegmentBytes.
+  // Returns its length, or -1 if it has been reused.
+  int copySegment(uint32_t seq, uint8_t* out) const {
+    if(!stillHeld(seq)) {
+      return -1;
+    }
+    const segment& S = _segments[seq % Segments];
+    uint16_t len = S.len.load(std::memory_order_acquire);
+    memcpy(out, S.data, len);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return stillHeld(seq) ? len : -1;
+  }
+
+private:
+  segment& current() { return _segments[(_started.load(std::memory_order_relaxed) - 1) % Segments]; }
+  const segment& current() const { return _segments[(_started.load(std::memory_order_relaxed) - 1) % Segments]; }
+  bool stillHeld(uint32_t seq) const { return _claimed.load(std::memory_order_relaxed) - seq <= Segments; }
+
+  segment _segments[Segments];
+  std::atomic<uint32_t> _claimed;   // _started + 1 while startSegment() is resetting a slot
+  std::atomic<uint32_t> _started;
+};
+
+// The download, a piece at a time like the JSON streams. Holds a copy of one segment, so it needs a bit over
+// SegmentBytes of heap.
+template<typename R>
+class TraceStream : public PendingStream<TraceStream<R>, R::segmentBytes() + 2, uint8_t> {
+  typedef PendingStream<TraceStream<R>, R::segmentBytes() + 2, uint8_t> pending;   // one segment and its length
+  friend pending;
+  using pending::_pending;
+  using pending::_len;
+  using pending::_pos;
+
+public:
+  TraceStream(const R& ring, uint8_t periodMs, uint8_t probes, uint8_t median) : _ring(ring), _seq(ring.oldest()), _end(ring.started()) {
+    memcpy(_pending, "TBKT", 4);
+    _pending[4] = CONTROL_TRACE_VERSION;
+    _pending[5] = periodMs;
+    _pending[6] = probes;
+    _pending[7] = median;
+    _len = 8;
+  }
+
+private:
+  bool refill() {
+    while(_seq < _end) {
+      int len = _ring.copySegment(_seq++, _pending + 2);
+      if(len > 0) {   // reused ones are left out, the next segment starts with a keyframe anyway
+        _pending[0] = len;
+        _pending[1] = len >> 8;
+        _len = len + 2;
+        _pos = 0;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const R& _ring;
+  uint32_t _seq;
+  uint32_t _end;
+};
+
+#endif
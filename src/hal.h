@@ -0,0 +1,35 @@
+/*
+    The few things the kettle control logic needs from the hardware, so kettleControl.h can run on the ESP32
+    and on a PC alike:
+    - clock:         halMicros() (64 bit, never rolls over), halEpoch() and halLocalTime() for wall time
+    - pump relay:    halPump()
+    - float switch:  halFloatBegin(), halFloatTake() for the debounce input, halFloatLevel() for a raw read.
+                     Whatever sits behind it has to cut the pump itself as soon as the float comes up.
+    - kettle arm:    halArmBegin(), halArmWrite()
+    - probes:        halProbeBegin(), halProbeResolution(), halProbeConvert(), halProbeRead()
+    - log output:    halLog()
+    The network side is not in here: the web server only talks to the control logic through commandQueue,
+    ackQueue and publishedState, so on the PC whatever drives it just uses those directly.
+
+    Everything is inline and picked at compile time, so the ESP32 build calls straight into the drivers.
+    halEsp32.h has the real implementation, native/halNative.h a simulated one for the PC build.
+*/
+
+#ifndef HAL
+#define HAL
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define PROBE_DISCONNECTED_C    -127.0f   // what a probe that does not answer reads, same as DallasTemperature
+
+#ifdef ARDUINO
+#include "halEsp32.h"
+#else
+#include "native/halNative.h"
+#endif
+
+inline uint32_t halMillis() { return halMicros() / 1000; }   // for short durations, wraps after 49 days like millis()
+
+#endif
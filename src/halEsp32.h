@@ -0,0 +1,144 @@
+/*
+    hal.h on the real kettle: esp_timer, the GPIO registers, ESP32Servo and DallasTemperature.
+*/
+
+#ifndef HAL_ESP32
+#define HAL_ESP32
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <driver/gpio.h>
+#include <soc/gpio_struct.h>
+#include <stdarg.h>
+#include <OneWire.h>
+#include <DallasTemperature.h>
+#include <ESP32Servo.h>
+
+#include "config/pins.h"
+
+OneWire oneWire(ONE_WIRE);
+DallasTemperature sensors(&oneWire);
+Servo kettleArm;
+
+inline int64_t halMicros() { return esp_timer_get_time(); }
+inline time_t halEpoch() { return time(nullptr); }
+inline bool halLocalTime(struct tm* t) { return getLocalTime(t, 0); }   // don't wait around for NTP
+
+inline void halLog(const char* format, ...) {
+  char buf[160];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  Serial.print(buf);
+}
+
+inline void halPump(bool on) { digitalWrite(PUMP, on ? HIGH : LOW); }
+
+// Used to debounce the float switch
+// Note: at the time of writing I only have one float switch and it is very jittery at full, this may be a fault of the switch, but I added the debounce in case it is common
+// Note on the previous note: Apparently it wasn't very jittery, the pin I was using seemed to have something else running on it. I regret not noting which pin it was because it caused a big headache. I am keeping the debounce in though because it may help anyways.
+// The float switch is on an interrupt. The interrupt cuts the pump relay itself as soon as the float comes up,
+// so the pump stops within microseconds instead of whenever the control task next looks. The control task
+// only takes the level as settled once the switch has not changed for a while (see isKettleFull()).
+// The interrupt is registered with ESP_INTR_FLAG_IRAM so it still runs while the flash cache is off (LittleFS
+// writes, OTA), everything it touches is in IRAM, DRAM or the GPIO registers. attachInterrupt() would register it
+// without that flag and the cut could then wait out a whole flash erase, tens of milliseconds. What is left is the
+// interrupt latency plus the longest critical section on the core it lands on, a few microseconds; maxCutUs only
+// measures from entering the interrupt.
+static_assert(PUMP < 32 && FSWITCH < 32, "onFloatEdge() uses the GPIO registers for pins 0-31");
+struct floatSwitchState {
+  bool level;         // level at the last edge, HIGH is full
+  int64_t edgeAt;     // esp_timer_get_time() of the last edge
+  bool cutPump;       // the interrupt switched the pump off, pumpStatus has not caught up yet
+  uint32_t edges;
+  uint32_t cuts;
+  uint32_t maxCutUs;  // longest time from entering the interrupt to the relay being off
+};
+volatile floatSwitchState floatSwitch = {LOW, 0, false, 0, 0, 0};
+portMUX_TYPE floatMux = portMUX_INITIALIZER_UNLOCKED;
+
+void IRAM_ATTR onFloatEdge(void*) {
+  int64_t now = esp_timer_get_time();
+  bool full = GPIO.in & (1UL << FSWITCH);
+  bool cut = full && (GPIO.out & (1UL << PUMP));
+  if(cut) {
+    GPIO.out_w1tc = 1UL << PUMP;    // DO NOT OVERFILL THE KETTLE, everything else can wait
+  }
+  uint32_t cutUs = esp_timer_get_time() - now;
+  portENTER_CRITICAL_ISR(&floatMux);
+  floatSwitch.level = full;
+  floatSwitch.edgeAt = now;
+  floatSwitch.edges++;
+  if(cut) {
+    floatSwitch.cutPump = true;
+    floatSwitch.cuts++;
+    if(cutUs > floatSwitch.maxCutUs) {
+      floatSwitch.maxCutUs = cutUs;
+    }
+  }
+  portEXIT_CRITICAL_ISR(&floatMux);
+}
+
+inline void halFloatBegin() {
+  pinMode(PUMP, OUTPUT);
+  pinMode(FSWITCH, INPUT_PULLUP);
+  floatSwitch.level = digitalRead(FSWITCH);   // the interrupt only tells us about changes
+  esp_err_t err = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+  if(err == ESP_ERR_INVALID_STATE) {
+    // Something else installed the GPIO interrupt service first, it may not be IRAM safe
+    halLog("Float switch: GPIO ISR service already installed, the cut may wait for flash writes\n");
+  }
+  gpio_set_intr_type((gpio_num_t)FSWITCH, GPIO_INTR_ANYEDGE);
+  gpio_isr_handler_add((gpio_num_t)FSWITCH, onFloatEdge, NULL);
+  gpio_intr_enable((gpio_num_t)FSWITCH);
+}
+
+// Level and time of the last edge. Returns true if the pump was cut since the last call.
+inline bool halFloatTake(bool& level, int64_t& edgeAt) {
+  portENTER_CRITICAL(&floatMux);
+  level = floatSwitch.level;
+  edgeAt = floatSwitch.edgeAt;
+  bool cut = floatSwitch.cutPump;
+  floatSwitch.cutPump = false;
+  portEXIT_CRITICAL(&floatMux);
+  return cut;
+}
+
+inline bool halFloatLevel() { return digitalRead(FSWITCH); }
+
+inline void halArmBegin() { kettleArm.attach(SERVO); }
+inline void halArmWrite(int angle) { kettleArm.write(angle); }
+
+// All the probes on the bus convert together (requestTemperatures() is a broadcast) and are then read back by the
+// addresses found in halProbeBegin(), so the bus is never searched again after boot.
+DeviceAddress probeAddress[8];
+uint8_t probesFound = 0;
+
+inline uint8_t halProbeBegin(uint8_t maxProbes) {   // Returns how many probes were found, at most maxProbes
+  sensors.begin();
+  uint8_t found = 0;
+  while(found < maxProbes && found < 8 && sensors.getAddress(probeAddress[found], found)) {
+    found++;
+  }
+  sensors.setWaitForConversion(false);    // conversions are polled by updateTemperature()
+  sensors.setAutoSaveScratchPad(false);   // the resolution changes with every heat on and off, keep it out of the EEPROM
+  probesFound = found;
+  return found;
+}
+
+// Sets every probe found at boot, returns the conversion time in ms. Called by the control task whenever
+// chooseResolution() changes its mind, so it only writes each probe's scratchpad by its cached address: no bus
+// search, no copy to EEPROM (and its 20ms wait). A probe that browns out comes back at its EEPROM resolution,
+// 12 bit unless someone changed it, which only makes its conversions slower than expected until the next change.
+inline unsigned long halProbeResolution(uint8_t bits) {
+  for(uint8_t i = 0; i < probesFound; i++) {
+    sensors.setResolution(probeAddress[i], bits, true);   // true: don't search the bus for the highest resolution again
+  }
+  return sensors.millisToWaitForConversion(bits);
+}
+
+inline void halProbeConvert() { sensors.requestTemperatures(); }    // returns straight away
+inline float halProbeRead(uint8_t probe) { return sensors.getTempC(probeAddress[probe]); }
+
+#endif
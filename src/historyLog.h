@@ -0,0 +1,244 @@
+/*
+    Append-only temperature history log on flash, so the history survives reboots and OTA updates.
+
+    The log is a ring of segment files (hist0.log, hist1.log, ...). Each segment starts with a header holding
+    a sequence number that goes up every time a segment is started, followed by fixed size records, each with
+    its own CRC. New samples are appended to the newest segment, and once it holds recordsPerSegment records
+    the oldest segment is truncated and reused, so the total flash used (and written) is bounded.
+    Samples are collected in RAM and written Batch at a time to keep the number of flash writes down.
+
+    At boot recover() only reads the header of every segment and then the newest segment itself, stopping at
+    the first record that fails its CRC or is cut short (e.g. one half written when the power went). The good
+    records of a damaged segment are copied into a fresh one, so new records never land behind the damage.
+
+    Only plain C stdio is used, so on the ESP32 it works on LittleFS through its VFS mount point and on a
+    PC it works on an ordinary directory.
+*/
+
+#ifndef HISTORY_LOG
+#define HISTORY_LOG
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "tempSample.h"
+
+inline uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc = 0xFFFF) {   // CRC-16/CCITT-FALSE
+  while(len--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for(int i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+template<size_t Batch>
+class HistoryLog {
+public:
+  HistoryLog(const char* dir, uint16_t segments, uint32_t recordsPerSegment) : _dir(dir), _segments(segments), _perSegment(recordsPerSegment),
+    _file(NULL), _segment(0), _seq(0), _records(0), _batched(0) {}
+
+  ~HistoryLog() {
+    if(_file != NULL) {
+      fclose(_file);
+    }
+  }
+
+  // Call once at boot before the first append(). Calls restore(const tempSample&) for every intact record in
+  // the newest segment, oldest first, and returns how many there were.
+  template<typename F>
+  uint32_t recover(F restore) {
+    bool found = false;
+    for(uint16_t i = 0; i < _segments; i++) {
+      uint32_t seq;
+      if(readHeader(i, seq) && (!found || seq > _seq)) {
+        found = true;
+        _segment = i;
+        _seq = seq;
+      }
+    }
+    if(!found) {
+      _segment = _segments - 1;   // so the first segment started is hist0
+      startSegment();
+      return 0;
+    }
+
+    char path[64];
+    segmentPath(_segment, path, sizeof(path));
+    FILE* f = fopen(path, "rb");
+    if(f == NULL) {
+      startSegment();
+      return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, sizeof(segmentHeader), SEEK_SET);
+    logRecord R;
+    bool torn = len < (long)sizeof(segmentHeader) || (len - sizeof(segmentHeader)) % sizeof(logRecord) != 0;   // a write cut short by the power going
+    uint32_t restored = 0;
+    while(fread(&R, sizeof(R), 1, f) == 1) {
+      if(!validRecord(R)) {
+        torn = true;    // anything after this can't be trusted, and appending after it would hide new records
+        break;
+      }
+      restore(R.sample);
+      restored++;
+    }
+    fclose(f);
+
+    if(torn) {
+      carryOver(path, restored);    // appending after the damage would leave every new record out of line
+    } else if(restored >= _perSegment) {
+      startSegment();
+    } else {
+      _records = restored;
+      _file = fopen(path, "ab");
+    }
+    return restored;
+  }
+
+  // Queues a sample, it is written once Batch samples have built up (or on flush())
+  void append(const tempSample& S) {
+    _batch[_batched++] = S;
+    if(_batched == Batch) {
+      flush();
+    }
+  }
+
+  // Writes everything queued so far, returns false if the write failed (the samples are dropped either way)
+  bool flush() {
+    bool ok = true;
+    size_t done = 0;
+    while(done < _batched) {
+      if(_file == NULL || _records >= _perSegment) {
+        if(!startSegment()) {
+          ok = false;
+          break;
+        }
+      }
+      size_t n = _batched - done;
+      if(n > _perSegment - _records) {
+        n = _perSegment - _records;
+      }
+      logRecord out[Batch];
+      for(size_t i = 0; i < n; i++) {
+        out[i].magic = RECORD_MAGIC;
+        out[i].sample = _batch[done + i];
+        out[i].crc = crc16((const uint8_t*)&out[i], sizeof(logRecord) - sizeof(uint16_t));
+      }
+      if(fwrite(out, sizeof(logRecord), n, _file) != n) {
+        ok = false;
+        break;
+      }
+      _records += n;
+      done += n;
+    }
+    if(_file != NULL) {
+      fflush(_file);
+      fsync(fileno(_file));   // LittleFS only commits to flash on sync
+    }
+    _batched = 0;
+    return ok;
+  }
+
+  uint32_t segmentSeq() const { return _seq; }
+  uint32_t recordsInSegment() const { return _records; }
+  static constexpr size_t recordBytes() { return sizeof(logRecord); }   // what one sample takes on flash
+
+private:
+  static const uint16_t HEADER_MAGIC = 0x5448;    // "TH"
+  static const uint16_t RECORD_MAGIC = 0x5452;    // "TR"
+
+  struct segmentHeader {
+    uint16_t magic;
+    uint32_t seq;
+    uint16_t crc;
+  } __attribute__((packed));
+
+  struct logRecord {
+    uint16_t magic;
+    tempSample sample;
+    uint16_t crc;
+  } __attribute__((packed));
+
+  static bool validRecord(const logRecord& R) {
+    return R.magic == RECORD_MAGIC && R.crc == crc16((const uint8_t*)&R, sizeof(logRecord) - sizeof(uint16_t));
+  }
+
+  void segmentPath(uint16_t segment, char* path, size_t len) const {
+    snprintf(path, len, "%s/hist%u.log", _dir, (unsigned)segment);
+  }
+
+  bool readHeader(uint16_t segment, uint32_t& seq) const {
+    char path[64];
+    segmentPath(segment, path, sizeof(path));
+    FILE* f = fopen(path, "rb");
+    if(f == NULL) {
+      return false;
+    }
+    segmentHeader H;
+    bool ok = fread(&H, sizeof(H), 1, f) == 1 && H.magic == HEADER_MAGIC && H.crc == crc16((const uint8_t*)&H, sizeof(H) - sizeof(uint16_t));
+    fclose(f);
+    seq = H.seq;
+    return ok;
+  }
+
+  // Starts the next segment with the first count records of the damaged segment at path, so they are still
+  // there after the next reboot. Only happens at boot after a torn write, so the extra flash write is rare.
+  void carryOver(const char* path, uint32_t count) {
+    if(!startSegment() || _segments < 2) {    // with one segment the damaged one has just been emptied
+      return;
+    }
+    FILE* f = fopen(path, "rb");
+    if(f == NULL) {
+      return;
+    }
+    fseek(f, sizeof(segmentHeader), SEEK_SET);
+    logRecord R;
+    while(_records < count && fread(&R, sizeof(R), 1, f) == 1 && fwrite(&R, sizeof(R), 1, _file) == 1) {
+      _records++;
+    }
+    fclose(f);
+    fflush(_file);
+    fsync(fileno(_file));
+  }
+
+  // Moves on to the next segment file, throwing away whatever it held
+  bool startSegment() {
+    if(_file != NULL) {
+      fclose(_file);
+    }
+    _segment = (_segment + 1) % _segments;
+    _seq++;
+    _records = 0;
+    char path[64];
+    segmentPath(_segment, path, sizeof(path));
+    _file = fopen(path, "wb");
+    if(_file == NULL) {
+      return false;
+    }
+    segmentHeader H = {HEADER_MAGIC, _seq, 0};
+    H.crc = crc16((const uint8_t*)&H, sizeof(H) - sizeof(uint16_t));
+    if(fwrite(&H, sizeof(H), 1, _file) != 1) {
+      fclose(_file);
+      _file = NULL;
+      return false;
+    }
+    return true;
+  }
+
+  const char* _dir;
+  uint16_t _segments;
+  uint32_t _perSegment;
+  FILE* _file;
+  uint16_t _segment;    // segment currently appended to
+  uint32_t _seq;        // its sequence number
+  uint32_t _records;    // records already in it
+  tempSample _batch[Batch];
+  size_t _batched;
+};
+
+#endif
@@ -0,0 +1,68 @@
+/*
+    Rolled up temperature history.
+
+    The raw history only covers NUM_TEMP_READINGS samples. Each HistoryTier summarizes every sample into
+    fixed width buckets (min/max/mean/count) so longer spans fit in a fixed amount of RAM, e.g. 1 minute
+    buckets for a day and 15 minute buckets for a month. Work per sample is constant: the sample is folded
+    into the bucket that is currently open, and when a sample lands past the end of that bucket it is closed
+    and stored. Closed buckets are kept in a SampleHistory so the web server can read them without locking.
+    Like SampleHistory, add() must only be called from one task.
+*/
+
+#ifndef HISTORY_TIERS
+#define HISTORY_TIERS
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "tempSample.h"
+#include "sampleHistory.h"
+
+template<size_t N>
+class HistoryTier {
+public:
+  typedef SampleHistory<N, tempBucket> store;
+
+  HistoryTier(const char* name, uint32_t width) : _name(name), _width(width), _count(0), _start(0), _min(0), _max(0), _sum(0) {}
+
+  void add(const tempSample& S) {
+    uint32_t start = S.epoch - (S.epoch % _width);
+    if(_count > 0 && (start != _start || _count == UINT16_MAX)) {
+      close();    // also catches the clock jumping, e.g. when NTP syncs after boot, or a bucket too full to count
+    }
+    if(_count == 0) {
+      _start = start;
+      _min = S.centiC;
+      _max = S.centiC;
+      _sum = 0;
+    }
+    if(S.centiC < _min) _min = S.centiC;
+    if(S.centiC > _max) _max = S.centiC;
+    _sum += S.centiC;
+    _count++;
+  }
+
+  const store& buckets() const { return _buckets; }
+  const char* name() const { return _name; }
+  uint32_t width() const { return _width; }         // seconds per bucket
+  uint32_t span() const { return _width * N; }      // seconds of history the tier holds once it is full
+
+private:
+  void close() {
+    tempBucket B = {_start, _min, _max, (int16_t)(_sum / (int32_t)_count), _count};
+    _buckets.add(B);
+    _count = 0;
+  }
+
+  const char* _name;
+  uint32_t _width;
+  store _buckets;
+  // the bucket currently being filled, only visible to the writer
+  uint16_t _count;
+  uint32_t _start;
+  int16_t _min;
+  int16_t _max;
+  int32_t _sum;
+};
+
+#endif
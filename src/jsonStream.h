@@ -0,0 +1,173 @@
+/*
+    Allocation-free JSON output for the temperature history.
+
+    ArduinoJson needed the whole history in a DynamicJsonDocument (which silently dropped samples once the
+    2048 bytes ran out) and then a String copy of the output. TempsJSONStream instead writes the history a
+    piece at a time into whatever buffer it is given, so it can feed a chunked web response directly and the
+    only RAM it needs is its own small state. The history size is limited only by the history itself.
+
+    Output: {"capacity":30,"data":[{"timeLabel":"HH:MM:SS","temp":21.50},...],"next":"5f3a9c-1234"}
+    next is the cursor to pass as since to only get newer samples next time: the history generation (changes
+    with every boot, the sequence numbers start again from whatever was restored) and the sequence number.
+*/
+
+#ifndef JSON_STREAM
+#define JSON_STREAM
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tempSample.h"
+#include "pendingStream.h"
+
+// Reads a cursor from TempsJSONStream's next field. Returns false if it isn't one.
+inline bool parseHistoryCursor(const char* text, uint32_t& generation, uint32_t& seq) {
+  char* end;
+  generation = strtoul(text, &end, 16);
+  if(end == text || *end != '-') {
+    return false;
+  }
+  const char* seqText = end + 1;
+  seq = strtoul(seqText, &end, 10);
+  return end != seqText && *end == 0;
+}
+
+// H is a SampleHistory. Only samples with a sequence number of at least since are sent. The samples to send
+// are fixed when the stream is made, anything added after that is left for the next request.
+template<typename H>
+class TempsJSONStream : public PendingStream<TempsJSONStream<H>, 64> {
+  typedef PendingStream<TempsJSONStream<H>, 64> pending;   // one sample at most
+  friend pending;
+  using pending::_pending;
+  using pending::_len;
+  using pending::_pos;
+
+public:
+  TempsJSONStream(const H& history, uint32_t since = 0, uint32_t generation = 0) : _history(history), _stage(STAGE_OPEN), _seq(since), _end(history.count()), _generation(generation), _first(true) {
+    if(_seq < _history.first()) {
+      _seq = _history.first();    // the ones asked for are already gone, send everything we still have
+    }
+  }
+
+  // Sequence number of the first sample not included, i.e. the history's count() when the stream was made
+  uint32_t end() const { return _end; }
+
+private:
+  enum stages {
+    STAGE_OPEN,
+    STAGE_SAMPLES,
+    STAGE_CLOSE,
+    STAGE_DONE
+  };
+
+  // Puts the next piece of output in _pending, returns false when there is nothing left
+  bool refill() {
+    _pos = 0;
+    _len = 0;
+    switch(_stage) {
+      case STAGE_OPEN:
+        _len = snprintf(_pending, sizeof(_pending), "{\"capacity\":%u,\"data\":[", (unsigned)H::capacity());
+        _stage = STAGE_SAMPLES;
+        return true;
+      case STAGE_SAMPLES:
+        while(_seq < _end) {
+          tempSample S;
+          if(!_history.read(_seq++, S)) {
+            continue;   // overwritten while we were sending, it is no longer part of the history
+          }
+          char label[9];
+          char temp[12];
+          formatCentiC(temp, sizeof(temp), S.centiC);
+          _len = snprintf(_pending, sizeof(_pending), "%s{\"timeLabel\":\"%s\",\"temp\":%s}", _first ? "" : ",", sampleTimeLabel(S, label, sizeof(label)), temp);
+          _first = false;
+          return true;
+        }
+        _stage = STAGE_CLOSE;
+        return refill();
+      case STAGE_CLOSE:
+        _len = snprintf(_pending, sizeof(_pending), "],\"next\":\"%x-%u\"}", (unsigned)_generation, (unsigned)_end);
+        _stage = STAGE_DONE;
+        return true;
+      case STAGE_DONE:
+      default:
+        return false;
+    }
+  }
+
+  const H& _history;
+  stages _stage;
+  uint32_t _seq;      // next sample to send
+  uint32_t _end;      // history count when the stream was made
+  uint32_t _generation;
+  bool _first;
+};
+
+// Streams the samples or buckets of one history tier that start at or after since.
+// H is a SampleHistory of tempSample or tempBucket or a CompressedHistory, raw samples come out as buckets of one.
+// Output: {"tier":"1m","width":60,"data":[{"t":1690000000,"min":21.50,"max":22.00,"mean":21.75,"n":4},...]}
+template<typename H>
+class BucketsJSONStream : public PendingStream<BucketsJSONStream<H>, 96> {
+  typedef PendingStream<BucketsJSONStream<H>, 96> pending;   // one bucket at most
+  friend pending;
+  using pending::_pending;
+  using pending::_len;
+  using pending::_pos;
+
+public:
+  BucketsJSONStream(const H& history, const char* tier, uint32_t width, uint32_t since) : _cursor(history, since), _tier(tier), _width(width), _since(since), _stage(STAGE_OPEN), _first(true) {}
+
+private:
+  enum stages {
+    STAGE_OPEN,
+    STAGE_ITEMS,
+    STAGE_CLOSE,
+    STAGE_DONE
+  };
+
+  bool refill() {
+    _pos = 0;
+    _len = 0;
+    switch(_stage) {
+      case STAGE_OPEN:
+        _len = snprintf(_pending, sizeof(_pending), "{\"tier\":\"%s\",\"width\":%u,\"data\":[", _tier, (unsigned)_width);
+        _stage = STAGE_ITEMS;
+        return true;
+      case STAGE_ITEMS:
+        typename H::item I;
+        while(_cursor.next(I)) {
+          tempBucket B = toBucket(I);
+          if(B.start < _since) {
+            continue;
+          }
+          char minC[12], maxC[12], meanC[12];
+          formatCentiC(minC, sizeof(minC), B.minC);
+          formatCentiC(maxC, sizeof(maxC), B.maxC);
+          formatCentiC(meanC, sizeof(meanC), B.meanC);
+          _len = snprintf(_pending, sizeof(_pending), "%s{\"t\":%u,\"min\":%s,\"max\":%s,\"mean\":%s,\"n\":%u}", _first ? "" : ",", (unsigned)B.start, minC, maxC, meanC, (unsigned)B.count);
+          _first = false;
+          return true;
+        }
+        _stage = STAGE_CLOSE;
+        return refill();
+      case STAGE_CLOSE:
+        _len = snprintf(_pending, sizeof(_pending), "]}");
+        _stage = STAGE_DONE;
+        return true;
+      case STAGE_DONE:
+      default:
+        return false;
+    }
+  }
+
+  typename H::cursor _cursor;
+  const char* _tier;
+  uint32_t _width;
+  uint32_t _since;
+  stages _stage;
+  bool _first;
+};
+
+#endif
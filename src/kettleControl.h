@@ -0,0 +1,779 @@
+/*
+    The kettle control logic: pump, heat, float switch, temperature probes, the kettle arm, the temperature
+    history and the command queue from the web side. It only touches hardware through hal.h, so the same code
+    runs on the kettle (included by main.cpp, stepped by controlTask()) and on a PC (included by
+    native/main.cpp, stepped by whatever drives the simulation).
+
+    Like userSettings.h this defines its globals rather than just declaring them, include it from exactly one
+    .cpp per build.
+*/
+
+#ifndef KETTLE_CONTROL
+#define KETTLE_CONTROL
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+
+#include "config/userSettings.h"
+#include "hal.h"
+#include "ringBuffer.h"
+#include "tempSample.h"
+#include "sampleHistory.h"
+#include "seqLock.h"
+#include "spscQueue.h"
+#include "historyTiers.h"
+#include "compressedHistory.h"
+#include "tempFilter.h"
+#include "controlTrace.h"
+#include "phaseTiming.h"
+
+// Presses of the kettle arm are queued and stepped from loop() by serviceKettleArm() so a press never stalls
+// the rest of the firmware for KETTLE_PRESS_MS. The timestamps are kept so actuation timing can be checked.
+struct armMove {
+  int angle;                  // position to press to before returning to KETTLE_NEUTRAL
+  bool started;
+  uint32_t queuedAt;     // all halMillis()
+  uint32_t startedAt;
+  uint32_t finishedAt;
+};
+RingBuffer<armMove, 4> armQueue;
+armMove lastArmMove = {KETTLE_NEUTRAL, false, 0, 0, 0};   // most recently completed press
+
+bool pumpStatus = LOW;
+bool heatStatus = LOW;
+bool kettleFull = false;
+bool pendingHeat = false;
+float tempReading = 0;
+int64_t lastTempRead = 0;   // halMicros(), microseconds since boot. 64 bit so it never rolls over
+
+// The DS18B20 takes up to 750ms to convert at 12 bit. Instead of blocking in requestTemperatures() we start a
+// conversion, let loop() keep running, and only read the result once the conversion time has passed.
+enum tempSensorStates {
+  TEMP_IDLE,          // no conversion running, start one on the next pass
+  TEMP_CONVERTING,    // conversion started at conversionStart, waiting for it to finish
+  TEMP_READING        // reading the probes back, one per pass so a pass never spends long on the bus
+};
+tempSensorStates tempSensorState = TEMP_IDLE;
+int64_t conversionStart = 0;
+unsigned long conversionTime = 750;   // updated whenever the sensor resolution changes
+
+// Full resolution is only needed close to the heat cut off. chooseResolution() runs the sensor at 10 bit once a
+// second while the heat is off, at 9 bit back to back while heating is still far from targetTemp (a reading
+// every 94ms), and at 12 bit back to back once it gets close.
+uint8_t tempResolution = 12;
+int64_t nextConversionAt = 0;   // TEMP_IDLE waits for this before starting the next conversion
+float heatingSlope = 0;         // degrees C per second, measured over at least slopeWindowUs
+int64_t slopeFromAt = 0;
+float slopeFromC = 0;
+const int64_t slopeWindowUs = 2000000;    // 9 bit readings move in 0.5 degree steps, so the slope needs a couple of seconds
+uint32_t tempConversions = 0;
+
+// All the probes convert together and are then read back one by one
+uint8_t probeCount = 0;   // probes found by controlBegin(), never changes after that
+const char* probeNames[MAX_PROBES] = PROBE_NAMES;
+float probeRaw[MAX_PROBES];       // as read from the probe
+float probeReading[MAX_PROBES];   // filtered, what everything else uses. Keeps the last good value while the probe is faulty
+TempFilter<TEMP_MEDIAN> probeFilter[MAX_PROBES];
+tempFaults probeFault[MAX_PROBES];
+tempFaults tempFault = TEMP_FAULT_DISCONNECTED;   // of the control probe, nothing heats until it has given good readings
+uint8_t readingProbe = 0;   // next probe TEMP_READING reads
+uint32_t cycleBusUs = 0;    // time spent on the bus by the current conversion cycle
+uint32_t lastBusUs = 0;     // and by the last complete one
+uint32_t maxBusUs = 0;
+
+SampleHistory<NUM_TEMP_READINGS> probeHistory[MAX_PROBES];   // fixed size, the oldest reading is dropped automatically once it is full. Safe to read from the web server.
+SampleHistory<NUM_TEMP_READINGS>& tempHistory = probeHistory[CONTROL_PROBE];   // the probe the heat is controlled by, the only one archived and saved
+static_assert(CONTROL_PROBE < MAX_PROBES, "CONTROL_PROBE has to be one of the MAX_PROBES probes");
+CompressedHistory<HISTORY_ARCHIVE_BLOCK_BYTES, HISTORY_ARCHIVE_BLOCKS> archiveHistory;    // every reading again, compressed, going back days
+HistoryTier<HISTORY_MINUTE_BUCKETS> minuteHistory("1m", 60);     // every reading also gets rolled up into these for the longer term
+HistoryTier<HISTORY_QUARTER_BUCKETS> quarterHistory("15m", 900);
+
+// Every reading is also saved to flash so the history survives a reboot or OTA update. The control task only
+// queues the reading and loop() does the writing, so LittleFS's own work and its lock stay out of the control step.
+// That doesn't make the writes free for the control task: while the flash is programmed or erased its cache is
+// off on both cores and anything not running from IRAM waits, the control task included (the float switch
+// interrupt doesn't, see halEsp32.h). A page write holds it up for around a millisecond, a 4KB sector erase when
+// a segment is reused for tens of milliseconds, so a period can start late. LOG_BATCH keeps the writes rare and the
+// max jitter in loop()'s control loop stats shows what they actually cost.
+SpscQueue<tempSample, 32> logQueue;   // control task -> loop()
+bool historyLogReady = false;         // set once there is a log to write them to
+
+// Copy of the kettle state published by the control side once per tick, the web server only ever reads this
+// and never the globals above, so it cannot see a half updated state.
+struct kettleState {
+  bool pump;
+  bool heat;
+  bool full;
+  bool pendingHeat;
+  float tempC;
+  float probeC[MAX_PROBES];
+  tempFaults fault;
+  tempFaults probeFault[MAX_PROBES];
+};
+SeqLock<kettleState> publishedState;
+
+// Commands from the web server (HTTP or WebSocket) to the control task. The names double as the HTTP path
+// and the WebSocket message, so keep them in the same order as kettleCommandType.
+enum kettleCommandType {
+  CMD_PUMP_ON,
+  CMD_PUMP_OFF,
+  CMD_PUMP_TOGGLE,
+  CMD_HEAT_ON,
+  CMD_HEAT_OFF,
+  CMD_FILL_AND_HEAT,
+  CMD_COUNT
+};
+const char* commandNames[CMD_COUNT] = {"pumpon", "pumpoff", "pumptoggle", "heaton", "heatoff", "fillandheat"};
+
+struct kettleCommand {
+  kettleCommandType type;
+  uint32_t id;
+  uint32_t queuedAt;    // halMicros() when the web server queued it
+};
+
+struct commandAck {
+  kettleCommandType type;
+  uint32_t id;
+  bool ok;              // false if the control logic refused it (e.g. heat with an empty kettle)
+  bool coalesced;       // cancelled out by another command in the same batch and never executed
+  uint32_t latencyUs;   // from being queued to being executed
+};
+
+SpscQueue<kettleCommand, 16> commandQueue;  // web server task -> control task
+SpscQueue<commandAck, 16> ackQueue;         // control task -> loop(), which sends them to the WebSocket clients
+RingBuffer<commandAck, 16> acksToSend;      // acks from the current control step, only handed over once the new state is published
+uint32_t nextCommandId = 1;                 // only used by the web server task
+uint32_t lastCommandHandled = 0;            // control task only
+std::atomic<uint32_t> lastCommandPublished(0);   // id of the newest command whose result is in publishedState
+
+int64_t lastOnHeat = 0;   // halMicros() like lastTempRead
+int64_t lastOnPump = 0;
+
+// The float switch is only taken as settled once it has not changed for this long
+const int64_t debounceDelayUs = 50000;
+
+// Every input the control logic takes and every output it makes is recorded into controlTrace, so what a kettle
+// did can be replayed on a PC (see controlTrace.h). traceStep() at the top of every controlStep() starts a new
+// segment with a keyframe whenever the current one is getting full.
+#if TRACE_SEGMENTS > 0
+TraceRing<TRACE_SEGMENT_BYTES, TRACE_SEGMENTS> controlTrace;
+tracePacker<160 + 64 * MAX_PROBES> traceKeyframeBuf;   // too big for the control task's stack
+const size_t traceStepReserve = 256;    // more than a step ever records, a new segment is started below this
+static_assert(TRACE_SEGMENT_BYTES >= 2 * (sizeof(traceKeyframeBuf.buf) + traceStepReserve), "TRACE_SEGMENT_BYTES is too small for a keyframe and a few steps");
+uint32_t traceStepCount = 0;    // control steps since boot
+uint32_t traceMarkStep = 0;     // step of the last STEP or KEYFRAME record
+int64_t traceMarkAt = 0;        // and its time
+int64_t traceStepAt = 0;        // halMicros() at the start of the current step
+bool traceStepMarked = false;   // the current step has its STEP or KEYFRAME record
+bool traceLost = true;          // something was dropped, the next keyframe can't carry on from what came before
+bool traceFloatLevel = LOW;     // the float switch as last recorded
+int64_t traceFloatEdgeAt = 0;
+
+// The control state a replay starts from. Keep traceSnapshot() and traceRestore() in step, and bump
+// CONTROL_TRACE_VERSION whenever they change.
+template<typename P>
+void traceSnapshot(P& p) {
+  p.u8(pumpStatus | heatStatus << 1 | kettleFull << 2 | pendingHeat << 3 | traceFloatLevel << 4);
+  p.u64(traceFloatEdgeAt);
+  p.f32(tempReading);
+  p.u64(lastTempRead);
+  p.u8(tempSensorState);
+  p.u64(conversionStart);
+  p.u32(conversionTime);
+  p.u8(tempResolution);
+  p.u64(nextConversionAt);
+  p.f32(heatingSlope);
+  p.u64(slopeFromAt);
+  p.f32(slopeFromC);
+  p.u8(probeCount);
+  p.u8(readingProbe);
+  p.u8(tempFault);
+  for(int i = 0; i < probeCount; i++) {
+    p.f32(probeRaw[i]);
+    p.f32(probeReading[i]);
+    p.u8(probeFault[i]);
+    probeFilter[i].save(p);
+  }
+  p.u64(lastOnHeat);
+  p.u64(lastOnPump);
+  p.u8(armQueue.size());
+  for(size_t i = 0; i < armQueue.size(); i++) {
+    p.zigzag(armQueue[i].angle);
+    p.u8(armQueue[i].started);
+    p.u32(armQueue[i].queuedAt);
+    p.u32(armQueue[i].startedAt);
+  }
+}
+
+template<typename U>
+void traceRestore(U& u) {
+  uint8_t flags = u.u8();
+  pumpStatus = flags & 1;
+  heatStatus = (flags >> 1) & 1;
+  kettleFull = (flags >> 2) & 1;
+  pendingHeat = (flags >> 3) & 1;
+  traceFloatLevel = (flags >> 4) & 1;
+  traceFloatEdgeAt = u.u64();
+  tempReading = u.f32();
+  lastTempRead = u.u64();
+  tempSensorState = (tempSensorStates)u.u8();
+  conversionStart = u.u64();
+  conversionTime = u.u32();
+  tempResolution = u.u8();
+  nextConversionAt = u.u64();
+  heatingSlope = u.f32();
+  slopeFromAt = u.u64();
+  slopeFromC = u.f32();
+  probeCount = u.u8();
+  if(probeCount > MAX_PROBES) {
+    probeCount = MAX_PROBES;
+  }
+  readingProbe = u.u8();
+  tempFault = (tempFaults)u.u8();
+  for(int i = 0; i < probeCount; i++) {
+    probeRaw[i] = u.f32();
+    probeReading[i] = u.f32();
+    probeFault[i] = (tempFaults)u.u8();
+    probeFilter[i].load(u);
+  }
+  lastOnHeat = u.u64();
+  lastOnPump = u.u64();
+  armQueue.clear();
+  uint8_t moves = u.u8();
+  for(uint8_t i = 0; i < moves; i++) {
+    armMove M = {0, false, 0, 0, 0};
+    M.angle = u.zigzag();
+    M.started = u.u8();
+    M.queuedAt = u.u32();
+    M.startedAt = u.u32();
+    armQueue.push(M);
+  }
+}
+
+void traceAppend(const uint8_t* data, size_t len) {
+  if(!controlTrace.append(data, len)) {
+    traceLost = true;
+  }
+}
+
+void traceKeyframe() {
+  traceKeyframeBuf.len = 0;
+  traceKeyframeBuf.u8(TRACE_KEYFRAME);
+  traceKeyframeBuf.u32(traceStepCount);
+  traceKeyframeBuf.u64(traceStepAt);
+  traceKeyframeBuf.u32(halEpoch());
+  traceKeyframeBuf.u8(traceLost ? 0 : TRACE_CONTINUES);
+  traceSnapshot(traceKeyframeBuf);
+  if(traceKeyframeBuf.full()) {
+    traceLost = true;   // can't happen with the static_assert above, but a broken keyframe would be worse than none
+    return;
+  }
+  controlTrace.startSegment();
+  controlTrace.append(traceKeyframeBuf.buf, traceKeyframeBuf.len);
+  traceLost = false;
+  traceMarkStep = traceStepCount;
+  traceMarkAt = traceStepAt;
+  traceStepMarked = true;
+}
+
+void traceStep(int64_t now) {   // First thing in every controlStep()
+  traceStepCount++;
+  traceStepAt = now;
+  traceStepMarked = false;
+  if(traceLost || controlTrace.room() < traceStepReserve) {
+    traceKeyframe();
+  }
+}
+
+void traceMark(tracePacker<>& P) {    // Puts the step's STEP record in front of its first record
+  if(traceStepMarked) {
+    return;
+  }
+  uint32_t steps = traceStepCount - traceMarkStep;
+  P.u8(TRACE_STEP);
+  P.varint(steps);
+  P.zigzag((int32_t)(traceStepAt - traceMarkAt - (int64_t)steps * CONTROL_PERIOD_MS * 1000));
+  traceMarkStep = traceStepCount;
+  traceMarkAt = traceStepAt;
+  traceStepMarked = true;
+}
+
+void traceProbe(uint8_t probe, float rawC) {
+  tracePacker<> P;
+  traceMark(P);
+  P.u8(TRACE_PROBE | probe << 4);
+  P.u16((uint16_t)(int16_t)lroundf(fmaxf(-256, fminf(255, rawC)) * 128));
+  traceAppend(P.buf, P.len);
+}
+
+void traceFloat(bool level, int64_t edgeAt, bool cut) {   // Only records changes
+  if(!cut && level == traceFloatLevel && edgeAt == traceFloatEdgeAt) {
+    return;
+  }
+  tracePacker<> P;
+  traceMark(P);
+  P.u8(TRACE_FLOAT | level << 4 | cut << 5);
+  P.zigzag((int32_t)(edgeAt - traceStepAt));
+  traceAppend(P.buf, P.len);
+  traceFloatLevel = level;
+  traceFloatEdgeAt = edgeAt;
+}
+
+void traceCommand(const kettleCommand& C) {
+  tracePacker<> P;
+  traceMark(P);
+  P.u8(TRACE_COMMAND | C.type << 4);
+  P.varint(C.id);
+  P.varint((uint32_t)traceStepAt - C.queuedAt);
+  traceAppend(P.buf, P.len);
+}
+
+void tracePump(bool on) {
+  tracePacker<> P;
+  traceMark(P);
+  P.u8(TRACE_PUMP | on << 4);
+  traceAppend(P.buf, P.len);
+}
+
+void traceArm(int angle) {
+  tracePacker<> P;
+  traceMark(P);
+  P.u8(TRACE_ARM);
+  P.varint(angle);
+  traceAppend(P.buf, P.len);
+}
+#else
+inline void traceStep(int64_t) {}
+inline void traceProbe(uint8_t, float) {}
+inline void traceFloat(bool, int64_t, bool) {}
+inline void traceCommand(const kettleCommand&) {}
+inline void tracePump(bool) {}
+inline void traceArm(int) {}
+#endif
+
+const char* strLocalTime(char* timeStr, size_t len)   // len should be at least 38
+{
+  struct tm timeinfo;
+  if(!halLocalTime(&timeinfo)){    // doesn't wait around for NTP, this is called while serving requests
+    strncpy(timeStr, "Error", len);
+    return timeStr;
+  }
+  strftime(timeStr, len, "%A, %B %d %Y %H:%M", &timeinfo);
+  return timeStr;
+}
+
+void updateSlope(int64_t now) {
+  if(slopeFromAt == 0) {
+    slopeFromAt = now;
+    slopeFromC = tempReading;
+  } else if(now - slopeFromAt >= slopeWindowUs) {
+    float slope = (tempReading - slopeFromC) * 1e6f / (now - slopeFromAt);
+    heatingSlope += (slope - heatingSlope) * 0.5f;
+    slopeFromAt = now;
+    slopeFromC = tempReading;
+  }
+}
+
+void chooseResolution(int64_t now) {   // Picks the resolution and pace of the following conversions
+  uint8_t bits = 10;
+  int64_t wait = TEMP_IDLE_PERIOD_MS * 1000LL;
+  if(heatStatus == HIGH || pendingHeat) {
+    float toGo = targetTemp - tempReading;
+    bits = 9;
+    wait = 0;
+    if(toGo < TEMP_FINE_BAND || (heatingSlope > 0 && toGo < heatingSlope * TEMP_FINE_ETA_S)) {
+      bits = 12;    // close to the cut off, or closing in fast enough to get there soon
+    }
+  }
+  if(bits != tempResolution) {
+    conversionTime = halProbeResolution(bits);
+    tempResolution = bits;
+  }
+  nextConversionAt = now + wait;
+}
+
+bool updateTemperature() {   // Steps the sensor state machine, returns True when a new reading was stored in tempReading
+  int64_t now = halMicros();
+  switch(tempSensorState) {
+    case TEMP_IDLE:
+      if(now < nextConversionAt && heatStatus == LOW && !pendingHeat) {
+        return false;   // nothing depends on the temperature right now, don't keep the bus busy
+      }
+      halProbeConvert();    // returns straight away
+      cycleBusUs = halMicros() - now;
+      conversionStart = now;
+      tempConversions++;
+      tempSensorState = TEMP_CONVERTING;
+      return false;
+    case TEMP_CONVERTING:
+      if(now - conversionStart < (int64_t)conversionTime * 1000) {
+        return false;   // still converting, check again next loop
+      }
+      readingProbe = 0;
+      tempSensorState = TEMP_READING;
+      return false;
+    case TEMP_READING:
+      if(readingProbe < probeCount) {
+        probeRaw[readingProbe] = halProbeRead(readingProbe);
+        traceProbe(readingProbe, probeRaw[readingProbe]);
+        cycleBusUs += halMicros() - now;
+        readingProbe++;
+      }
+      if(readingProbe < probeCount) {
+        return false;
+      }
+      lastBusUs = cycleBusUs;
+      if(lastBusUs > maxBusUs) {
+        maxBusUs = lastBusUs;
+      }
+      for(int i = 0; i < probeCount; i++) {
+        probeFault[i] = probeFilter[i].add(probeRaw[i], now, heatStatus == HIGH);
+        if(probeFault[i] == TEMP_OK) {
+          probeReading[i] = probeFilter[i].value();
+        }
+      }
+      tempReading = probeReading[CONTROL_PROBE];    // stays at PROBE_DISCONNECTED_C if that probe wasn't found
+      if(CONTROL_PROBE < probeCount) {
+        if(probeFault[CONTROL_PROBE] != tempFault) {
+          halLog("Temperature sensor: %s\n", tempFaultName(probeFault[CONTROL_PROBE]));
+        }
+        tempFault = probeFault[CONTROL_PROBE];
+      }
+      tempSensorState = TEMP_IDLE;
+      if(tempFault == TEMP_OK) {
+        updateSlope(now);
+      }
+      chooseResolution(now);
+      return true;
+  }
+  return false;
+}
+
+bool isKettleFull() {   // Returns True if kettle is full, else returns False. Also, sets kettleFull boolean. Control task only.
+  bool currentFloat;
+  int64_t lastEdge;
+  bool cutPump = halFloatTake(currentFloat, lastEdge);
+  traceFloat(currentFloat, lastEdge, cutPump);
+
+  if(cutPump && pumpStatus == HIGH) {
+    halLog("Float switch cut the pump\n");
+    pumpStatus = LOW;   // the float switch interrupt already switched the relay off
+  }
+
+  if(halMicros() - lastEdge > debounceDelayUs) {
+    // no edges for longer than the debounce delay, so take it as an actual change in state
+    if(currentFloat == LOW) {
+      if(kettleFull) {halLog("Kettle is low\n");}   // Only print on state change
+      kettleFull = false;
+    } else {
+      if(!kettleFull) {halLog("Kettle is full\n");}   // Only print on state change
+      kettleFull = true;
+    }
+  }
+  return kettleFull;
+}
+
+void pumpOff() {
+  if(pumpStatus == HIGH) {    // Only turns pump off if it is currently on (prevents unnecessary relay switching)
+    halLog("Turning pump off\n");
+    pumpStatus = LOW;
+    halPump(pumpStatus);
+    tracePump(pumpStatus);
+  }
+}
+
+bool pumpOn() {
+  halLog("pumpOn\n");
+  if(isKettleFull() == false && halFloatLevel() == LOW) {   // DO NOT OVERFILL THE KETTLE AND FLOOD THE PLACE (the raw read catches a float that is up but not settled yet)
+    halLog("Turning pump on\n");
+    if(pumpStatus == LOW) {   // Only turns on pump if it is currently off (prevents unnecessary relay switching)
+      pumpStatus = HIGH;
+      lastOnPump = halMicros();    // Used to track how long the pump has been running as a backup to a faulty float switch
+      halPump(pumpStatus);
+      tracePump(pumpStatus);
+    }
+    return true;
+  }
+  halLog("Kettle is too full for pump\n");
+  pumpStatus = LOW;
+  return false;
+}
+
+bool queueArmMove(int angle) {
+  if(!armQueue.empty() && armQueue.back().angle == angle) {
+    return true;    // the same press is already waiting, pressing twice in a row does nothing useful
+  }
+  if(armQueue.full()) {
+    halLog("Kettle arm queue is full, dropping press\n");
+    return false;
+  }
+  armMove M = {angle, false, halMillis(), 0, 0};
+  armQueue.push(M);
+  return true;
+}
+
+void serviceKettleArm() {   // Called every loop, moves the arm through whatever presses are queued without blocking
+  if(armQueue.empty()) {
+    return;
+  }
+  armMove& M = armQueue.front();
+  if(!M.started) {
+    halArmWrite(M.angle);
+    traceArm(M.angle);
+    M.started = true;
+    M.startedAt = halMillis();
+  } else if(halMillis() - M.startedAt >= KETTLE_PRESS_MS) {
+    halArmWrite(KETTLE_NEUTRAL);
+    traceArm(KETTLE_NEUTRAL);
+    M.finishedAt = halMillis();
+    lastArmMove = M;
+    armQueue.pop();
+    halLog("Kettle arm press to %d done, waited %ums in queue, held %ums\n", lastArmMove.angle, (unsigned)(lastArmMove.startedAt - lastArmMove.queuedAt), (unsigned)(lastArmMove.finishedAt - lastArmMove.startedAt));
+  }
+}
+
+void kettleOff() {
+  halLog("Turning kettle off\n");
+  queueArmMove(KETTLE_OFF);
+  heatStatus = LOW;
+}
+
+bool tempTrusted() {   // True once the control probe has given enough good readings in a row to fill its filter
+  return tempFault == TEMP_OK && probeFilter[CONTROL_PROBE].goodRun() >= TEMP_MEDIAN;
+}
+
+bool kettleOn() {
+  halLog("Turning kettle on\n");
+  if(!tempTrusted()) {    // without a temperature nothing would turn it off again but the timeout
+    halLog("Temperature sensor fault (%s), not heating\n", tempFaultName(tempFault));
+    return false;
+  }
+  if(isKettleFull()) {    // Only turn kettle on if the kettle is full
+    queueArmMove(KETTLE_ON);
+    lastOnHeat = halMicros();    // Used to track how long the heat has been running as a backup to a faulty temp sensor
+    heatStatus = HIGH;
+    return true;
+  }
+  halLog("Kettle is not full enough for heat\n");
+  return false;
+  
+}
+
+void publishState() {   // Only called by the control task
+  kettleState K = {pumpStatus == HIGH, heatStatus == HIGH, kettleFull, pendingHeat, tempReading, {}, tempFault, {}};
+  for(int i = 0; i < MAX_PROBES; i++) {
+    K.probeC[i] = probeReading[i];
+    K.probeFault[i] = probeFault[i];
+  }
+  publishedState.write(K);
+}
+
+// The most statusJSON() can write: the fixed part with the longest temperature, fault name and time, VERSION,
+// and 72 bytes a probe (enough for a name of up to 22 characters). Size every buffer for it with this.
+const size_t statusJSONBytes = 192 + sizeof(VERSION) + 72 * MAX_PROBES;
+
+size_t statusJSON(char* buf, size_t len) {   // Writes the current kettle status into buf, returns the length, 0 if it did not fit
+  kettleState K = publishedState.read();
+  char timeStr[38];
+  char temp[12];
+  formatCentiC(temp, sizeof(temp), toCentiC(K.tempC));
+  char probes[72 * MAX_PROBES + 3];
+  size_t p = snprintf(probes, sizeof(probes), "[");
+  for(int i = 0; i < probeCount && p < sizeof(probes); i++) {
+    char probeTemp[12];
+    formatCentiC(probeTemp, sizeof(probeTemp), toCentiC(K.probeC[i]));
+    p += snprintf(probes + p, sizeof(probes) - p, "%s{\"name\":\"%s\",\"temp\":%s,\"fault\":\"%s\"}", i ? "," : "", probeNames[i] ? probeNames[i] : "probe", probeTemp, tempFaultName(K.probeFault[i]));
+  }
+  if(p + 1 >= sizeof(probes)) {
+    return 0;   // a probe name too long for its share, better nothing than broken JSON
+  }
+  snprintf(probes + p, sizeof(probes) - p, "]");
+  int n = snprintf(buf, len, "{\"pump\":%s,\"heat\":%s,\"kettle\":%s,\"pendingheat\":%s,\"tempreading\":%s,\"sensorfault\":\"%s\",\"probes\":%s,\"datetime\":\"%s\",\"version\":\"%s\"}",
+                   K.pump ? "true" : "false", K.heat ? "true" : "false", K.full ? "true" : "false", K.pendingHeat ? "true" : "false",
+                   temp, tempFaultName(K.fault), probes, strLocalTime(timeStr, sizeof(timeStr)), VERSION);
+  return (n < 0 || (size_t)n >= len) ? 0 : n;
+}
+
+// The WebSocket frames other than the status, both return the length like statusJSON()
+size_t sampleFrameJSON(char* buf, size_t len, const tempSample& S) {   // the newest history sample, 64 bytes is plenty
+  char label[9];
+  char temp[12];
+  formatCentiC(temp, sizeof(temp), S.centiC);
+  int n = snprintf(buf, len, "{\"sample\":{\"timeLabel\":\"%s\",\"temp\":%s}}", sampleTimeLabel(S, label, sizeof(label)), temp);
+  return (n < 0 || (size_t)n >= len) ? 0 : n;
+}
+
+size_t ackFrameJSON(char* buf, size_t len, const commandAck& A) {   // 128 bytes is plenty
+  int n = snprintf(buf, len, "{\"ack\":%u,\"cmd\":\"%s\",\"ok\":%s,\"coalesced\":%s,\"latencyus\":%u}",
+                   (unsigned)A.id, commandNames[A.type], A.ok ? "true" : "false", A.coalesced ? "true" : "false", (unsigned)A.latencyUs);
+  return (n < 0 || (size_t)n >= len) ? 0 : n;
+}
+
+uint32_t queueCommand(kettleCommandType type) {   // Called from the web server task, returns the command id or 0 if the queue is full
+  kettleCommand C = {type, nextCommandId, (uint32_t)halMicros()};
+  if(!commandQueue.push(C)) {
+    halLog("Command queue is full, dropping %s\n", commandNames[type]);
+    return 0;
+  }
+  return nextCommandId++;
+}
+
+bool runCommand(kettleCommandType type) {   // Control task only
+  switch(type) {
+    case CMD_PUMP_ON:
+      return pumpOn();
+    case CMD_PUMP_OFF:
+      pumpOff();
+      return true;
+    case CMD_PUMP_TOGGLE:
+      if(pumpStatus == HIGH) {
+        pumpOff();
+        return true;
+      }
+      return pumpOn();
+    case CMD_HEAT_ON:
+      return kettleOn();
+    case CMD_HEAT_OFF:
+      pendingHeat = false;
+      kettleOff();
+      return true;
+    case CMD_FILL_AND_HEAT:
+      pendingHeat = true;   // the control loop turns the heat on once the float switch says the kettle is full
+      pumpOn();
+      return true;
+    default:
+      return false;
+  }
+}
+
+// True once command id has been run and the state it produced published, safe from any task
+bool commandPublished(uint32_t id) {
+  return (int32_t)(lastCommandPublished.load(std::memory_order_acquire) - id) >= 0;   // ids wrap
+}
+
+void ackCommand(const kettleCommand& C, bool ok, bool coalesced) {
+  lastCommandHandled = C.id;
+  commandAck A = {C.type, C.id, ok, coalesced, (uint32_t)halMicros() - C.queuedAt};
+  if(acksToSend.full()) {
+    acksToSend.pop();   // more commands than fit in one step, the oldest ack is the least interesting
+  }
+  acksToSend.push(A);
+}
+
+void handleCommands() {   // Runs everything the web server queued since the last control step
+  kettleCommand C;
+  while(commandQueue.pop(C)) {
+    traceCommand(C);
+    const kettleCommand* next = commandQueue.peek();
+    if(C.type == CMD_PUMP_TOGGLE && next != NULL && next->type == CMD_PUMP_TOGGLE) {
+      // Two toggles in a row cancel out (usually a double click), skip both rather than clicking the relay twice
+      kettleCommand second;
+      commandQueue.pop(second);
+      traceCommand(second);
+      ackCommand(C, true, true);
+      ackCommand(second, true, true);
+      continue;
+    }
+    ackCommand(C, runCommand(C.type), false);
+  }
+}
+
+void sendAcks() {   // Control task only, call after publishState() so clients never get an ack before the state it produced
+  while(!acksToSend.empty()) {
+    if(!ackQueue.push(acksToSend.front())) {
+      break;    // loop() is behind, try again next step
+    }
+    acksToSend.pop();
+  }
+}
+
+void controlStep() {   // One pass of the kettle control logic, called every CONTROL_PERIOD_MS by controlTask()
+  // 0. Run whatever the web server asked for
+  traceStep(halMicros());
+  {
+    PHASE_TIME(PHASE_COMMANDS);
+    handleCommands();
+  }
+
+  // 1. Check water level
+  {
+    PHASE_TIME(PHASE_FLOAT);
+    if (isKettleFull()) {           // a. Kettle is full, stop the pump
+      pumpOff();
+      if (pendingHeat) {
+        pendingHeat = false;
+        kettleOn();
+      }
+    } else {                        // b. Kettle is not full, kill the heat if needed
+      if (heatStatus == HIGH) {
+        kettleOff();
+      }
+      if(pumpStatus == HIGH && (halMicros() - lastOnPump) >= (int64_t)timeoutPump * 1000) {    // c. Safety check, if the pump fails to turn off for a failure of the float switch, leak, or lack of water, it will time out
+        pumpOff();
+      }
+      // Check if we want to refill the kettle later, that is a lower priority action
+    }
+  }
+
+  // 2. Check heat
+  {
+    PHASE_TIME(PHASE_TEMPERATURE);
+    updateTemperature();    // never blocks, tempReading keeps the last completed reading until a new one is ready
+    if(heatStatus == HIGH) {
+      if(!tempTrusted() || tempReading >= targetTemp || (halMicros() - lastOnHeat) >= (int64_t)timeoutHeat * 1000) {   // a. Turn off heat if the sensor is faulty, it is at the target temp or it has been running for too long
+        kettleOff();
+      }
+    }
+  }
+  if((halMicros() - lastTempRead) >= TEMP_READ_FREQ * 1000LL) {
+    PHASE_TIME(PHASE_HISTORY);
+    lastTempRead = halMicros();
+    time_t now = halEpoch();
+    for(int i = 0; i < probeCount; i++) {
+      if(i != CONTROL_PROBE) {
+        probeHistory[i].add(makeSample(now, probeReading[i]));
+      }
+    }
+    tempSample S = makeSample(now, tempReading);
+    tempHistory.add(S);
+    archiveHistory.add(S);
+    minuteHistory.add(S);
+    quarterHistory.add(S);
+    if(historyLogReady) {
+      logQueue.push(S);   // if loop() has fallen that far behind, losing a saved reading is the least of our worries
+    }
+  }
+
+  // 3. Move the kettle arm if a press is queued
+  {
+    PHASE_TIME(PHASE_ARM);
+    serviceKettleArm();
+  }
+
+  // 4. Let the web server see the new state
+  PHASE_TIME(PHASE_PUBLISH);
+  publishState();
+  lastCommandPublished.store(lastCommandHandled, std::memory_order_release);
+  sendAcks();
+}
+
+// Call once at boot before the first controlStep(), after halFloatBegin()
+void controlBegin() {
+  probeCount = halProbeBegin(MAX_PROBES);
+  for(int i = 0; i < MAX_PROBES; i++) {
+    probeReading[i] = PROBE_DISCONNECTED_C;
+    probeFilter[i] = TempFilter<TEMP_MEDIAN>(TEMP_MAX_SLEW, TEMP_STUCK_MS * 1000LL);
+    probeFault[i] = TEMP_FAULT_DISCONNECTED;
+  }
+  halLog("Found %u temperature probe(s)\n", probeCount);
+  conversionTime = halProbeResolution(tempResolution);    // chooseResolution() takes over after the first reading
+
+  halArmBegin();
+  kettleOff();
+  publishState();
+}
+
+#endif
@@ -5,47 +5,38 @@
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #include "time.h"
-#include <OneWire.h>
-#include <DallasTemperature.h>
-#include <ESP32Servo.h>
-#include <ArduinoJson.h>
+#include <LittleFS.h>
 #include <AsyncElegantOTA.h>
+#include <memory>
  
 #include "config/userSettings.h"
 #include "config/pins.h"
-#include "htmlData.h"
-#include "listLinked.h"   // a linked list library was used, but the naming conflicted with a linked list implementation in the async web server (web server version was missing required functionality), hence list linked
+#include "kettleControl.h"    // everything that runs the kettle itself, this file is the web side and the tasks
+#include "webAssets.h"    // generated from web/ by tools/gzipWebAssets.py
+#include "jsonStream.h"
+#include "historyLog.h"
+#include "binaryExport.h"
+#include "pendingStream.h"
+#ifdef KETTLE_BENCH
+#include "benchmarks.h"   // pio run -e esp32dev-bench
+#endif
 
 AsyncWebServer server(80);
 AsyncWebSocket ws("/ws");
 
-OneWire oneWire(ONE_WIRE);
-DallasTemperature sensors(&oneWire);
+HistoryLog<LOG_BATCH> historyLog("/littlefs", LOG_SEGMENTS, LOG_SEGMENT_RECORDS);   // written by loop() from logQueue
 
-Servo kettleArm;
-
-bool pumpStatus = LOW;
-bool heatStatus = LOW;
-bool kettleFull = false;
-bool pendingHeat = false;
-float tempReading = 0;
-float lastTempRead = 0;
-
-struct temperature{
-   String timeLabel;
-   float temp;
+// The control logic runs in its own FreeRTOS task on CONTROL_CORE every CONTROL_PERIOD_MS, the web server and
+// WiFi stay on the other core (see CONFIG_ASYNC_TCP_RUNNING_CORE in platformio.ini).
+// The control task is the only thing that changes the pump/heat state, the web server asks it to through commandQueue.
+struct controlTiming {
+  uint32_t ticks;         // number of control periods run
+  uint32_t overruns;      // periods where the control step took longer than CONTROL_PERIOD_MS
+  uint32_t maxRunUs;      // longest control step
+  uint32_t maxJitterUs;   // worst difference between the actual and the expected start of a period
 };
-ListLinked<temperature> tempHistory;
-
-float lastOnHeat = 0;
-float lastOnPump = 0;
-
-// Used to debounce the float switch
-// Note: at the time of writing I only have one float switch and it is very jittery at full, this may be a fault of the switch, but I added the debounce in case it is common
-// Note on the previous note: Apparently it wasn't very jittery, the pin I was using seemed to have something else running on it. I regret not noting which pin it was because it caused a big headache. I am keeping the debounce in though because it may help anyways.
-bool lastFloatState = LOW;
-float lastDebounceTime = 0;
-float debounceDelay = 50;
+controlTiming controlStats = {0, 0, 0, 0};
+unsigned long lastStatsReport = 0;
 
 void printLocalTime()
 {
@@ -57,124 +48,151 @@ void printLocalTime()
   Serial.println(&timeinfo, "%A, %B %d %Y %H:%M:%S");
 }
 
-String strLocalTime()
-{
-  struct tm timeinfo;
-  if(!getLocalTime(&timeinfo)){
-    return "Error";
+typedef TempsJSONStream<SampleHistory<NUM_TEMP_READINGS> > tempsJSON;
+
+const SampleHistory<NUM_TEMP_READINGS>& historyFor(AsyncWebServerRequest* request) {   // ?probe=<n>, the control probe if there is none
+  if(request->hasParam("probe")) {
+    int probe = request->getParam("probe")->value().toInt();
+    if(probe >= 0 && probe < probeCount) {
+      return probeHistory[probe];
+    }
   }
-  char timeStr[38];
-  strftime(timeStr, 38, "%A, %B %d %Y %H:%M", &timeinfo);
-  return timeStr;
+  return tempHistory;
 }
 
-String justTime()
-{
-  struct tm timeinfo;
-  if(!getLocalTime(&timeinfo)){
-    return "Error";
-  }
-  char timeStr[9];
-  strftime(timeStr, 9, "%H:%M:%S", &timeinfo);
-  return timeStr;
+template<typename H>
+void sendBuckets(AsyncWebServerRequest* request, const H& history, const char* tier, uint32_t width, uint32_t since) {
+  BucketsJSONStream<H> stream(history, tier, width, since);
+  request->send(request->beginChunkedResponse("application/json", [stream](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+    return stream.read(buffer, maxLen);
+  }));
 }
 
-bool isKettleFull() {   // Returns True if kettle is full, else returns False. Also, sets kettleFull boolean.
-  bool currentFloat = digitalRead(FSWITCH);
-  //Serial.println(currentFloat);
-  if(currentFloat != lastFloatState) {
-    lastDebounceTime = millis();
-  }
-
-  if((millis() - lastDebounceTime) > debounceDelay) {
-    // state changed longer than the debounceDelay, so take it as an actual change in state 
-    if(currentFloat == LOW) {
-      if(kettleFull) {Serial.println("Kettle is low");}   // Only print on state change
-      kettleFull = false;
-    } else {
-      if(!kettleFull) {Serial.println("Kettle is full");}   // Only print on state change
-      kettleFull = true;
-    }
+void handleHistory(AsyncWebServerRequest* request) {   // /history?span=<seconds>, answers from the finest tier that covers the span
+  const uint32_t rawSpan = (uint32_t)NUM_TEMP_READINGS * TEMP_READ_FREQ / 1000;
+  uint32_t span = rawSpan;
+  if(request->hasParam("span")) {
+    span = request->getParam("span")->value().toInt();
+  }
+  uint32_t now = time(nullptr);
+  uint32_t since = now > span ? now - span : 0;
+
+  uint32_t archiveStart = archiveHistory.oldestEpoch();
+  if(span <= rawSpan) {
+    sendBuckets(request, tempHistory, "raw", TEMP_READ_FREQ / 1000, since);
+  } else if(archiveStart != 0 && archiveStart <= since) {   // the archive still goes back far enough for every reading
+    sendBuckets(request, archiveHistory, "raw", TEMP_READ_FREQ / 1000, since);
+  } else if(span <= minuteHistory.span()) {
+    sendBuckets(request, minuteHistory.buckets(), minuteHistory.name(), minuteHistory.width(), since);
+  } else {
+    sendBuckets(request, quarterHistory.buckets(), quarterHistory.name(), quarterHistory.width(), since);
   }
-
-  lastFloatState = currentFloat;
-  return kettleFull;
 }
 
-void pumpOff() {
-  if(pumpStatus == HIGH) {    // Only turns pump off if it is currently on (prevents unnecessary relay switching)
-    Serial.println("Turning pump off");
-    pumpStatus = LOW;
-    digitalWrite(PUMP, pumpStatus);
+// /api/temps?since=<cursor> only sends the samples newer than the cursor a client got last time (the "next"
+// field). A cursor from before a reboot, or from beyond the newest sample, is stale and gets everything. The ETag
+// is the cursor the response ends at, so a client that sends it back in If-None-Match gets a 304 until a new
+// sample has been stored. Without If-None-Match the answer is always a 200, with empty data if nothing is new.
+uint32_t historyGeneration = 0;   // random at boot, the sequence numbers start again from whatever was restored
+
+void handleTempsSince(AsyncWebServerRequest* request) {
+  const SampleHistory<NUM_TEMP_READINGS>& history = historyFor(request);
+  uint32_t since = 0;
+  uint32_t generation, seq;
+  if(request->hasParam("since") && parseHistoryCursor(request->getParam("since")->value().c_str(), generation, seq)
+     && generation == historyGeneration && seq <= history.count()) {
+    since = seq;
+  }
+  tempsJSON temps(history, since, historyGeneration);
+  char cursor[24];
+  snprintf(cursor, sizeof(cursor), "%x-%u", historyGeneration, temps.end());
+  char etag[28];
+  snprintf(etag, sizeof(etag), "\"%s\"", cursor);
+
+  AsyncWebServerResponse* response;
+  if(request->hasHeader("If-None-Match") && request->header("If-None-Match") == etag) {
+    response = request->beginResponse(304);
+  } else {
+    response = request->beginChunkedResponse("application/json", [temps](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+      return temps.read(buffer, maxLen);
+    });
   }
+  response->addHeader("ETag", etag);
+  response->addHeader("Cache-Control", "no-cache");   // caches may keep it, but have to check the ETag every time
+  response->addHeader("X-History-Cursor", cursor);
+  request->send(response);
 }
 
-bool pumpOn() {
-  Serial.println("pumpOn");
-  if(isKettleFull() == false) {   // DO NOT OVERFILL THE KETTLE AND FLOOD THE PLACE
-    Serial.println("Turning pump on");
-    if(pumpStatus == LOW) {   // Only turns on pump if it is currently off (prevents unnecessary relay switching)
-      pumpStatus = HIGH;
-      lastOnPump = millis();    // Used to track how long the pump has been running as a backup to a faulty float switch
-      digitalWrite(PUMP, pumpStatus);
-    }
-    return true;
+// /api/history.bin?since=<epoch> streams every raw reading in the archive in the compact binary format from
+// binaryExport.h, add &format=cbor for the CBOR version. tools/historyToCsv.cpp turns the binary one into CSV.
+void handleHistoryExport(AsyncWebServerRequest* request) {
+  uint32_t since = 0;
+  if(request->hasParam("since")) {
+    since = strtoul(request->getParam("since")->value().c_str(), NULL, 10);
   }
-  Serial.println("Kettle is too full for pump");
-  pumpStatus = LOW;
-  return false;
+  bool cbor = request->hasParam("format") && request->getParam("format")->value() == "cbor";
+  BinaryHistoryStream<CompressedHistory<HISTORY_ARCHIVE_BLOCK_BYTES, HISTORY_ARCHIVE_BLOCKS> > stream(archiveHistory, TEMP_READ_FREQ / 1000, since, cbor);
+  request->send(request->beginChunkedResponse(cbor ? "application/cbor" : "application/octet-stream", [stream](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+    return stream.read(buffer, maxLen);
+  }));
 }
 
-void kettleOff() {
-  Serial.println("Turning kettle off");
-  kettleArm.write(KETTLE_OFF);
-  delay(250);
-  kettleArm.write(KETTLE_NEUTRAL);
-  heatStatus = LOW;
-}
+// The command routes answer with the status the command left the kettle in, as /pumptoggle always has. The
+// command only runs at the next control step, so until the control task has published its result ready() is
+// false and the response holds off (RESPONSE_TRY_AGAIN, the server asks again when it next polls the
+// connection). After commandWaitMs it gives up waiting and sends the status as it is.
+const uint32_t commandWaitMs = 1000;
 
-bool kettleOn() {
-  Serial.println("Turning kettle on");
-  if(isKettleFull()) {    // Only turn kettle on if the kettle is full
-    kettleArm.write(KETTLE_ON);
-    lastOnHeat = millis();    // Used to track how long the heat has been running as a backup to a faulty temp sensor
-    delay(250);
-    kettleArm.write(KETTLE_NEUTRAL);
-    heatStatus = HIGH;
-    return true;
+class CommandStatusStream : public PendingStream<CommandStatusStream, statusJSONBytes> {
+  friend class PendingStream<CommandStatusStream, statusJSONBytes>;
+
+public:
+  CommandStatusStream(uint32_t id) : _id(id), _queuedAt(millis()), _sent(false) {}
+
+  bool ready() const { return commandPublished(_id) || millis() - _queuedAt >= commandWaitMs; }
+
+private:
+  bool refill() {
+    if(_sent) {
+      return false;
+    }
+    _sent = true;
+    _pos = 0;
+    _len = statusJSON(_pending, sizeof(_pending));
+    return _len > 0;
   }
-  Serial.println("Kettle is not full enough for heat");
-  return false;
-  
-}
-String statusJSON() {
-  DynamicJsonDocument status(512);
-  status["pump"] = pumpStatus;
-  status["heat"] = heatStatus;
-  status["kettle"] = kettleFull;
-  status["pendingheat"] = pendingHeat;
-  status["tempreading"] = tempReading;
-  status["datetime"] = strLocalTime();
-  status["version"] = VERSION;
-
-  String buf;
-  serializeJson(status, buf);
-  Serial.println(buf);
-  return buf;
+
+  uint32_t _id;
+  uint32_t _queuedAt;
+  bool _sent;
+};
+
+#if TRACE_SEGMENTS > 0
+// /api/trace downloads the control trace (controlTrace.h) for replaying on a PC with the native build:
+//   curl -s http://tipsybrewkettle.local/api/trace -o kettle.trace && .pio/build/native/program replay kettle.trace
+// The stream holds a copy of a whole segment, so it lives on the heap rather than in the callback.
+void handleTrace(AsyncWebServerRequest* request) {
+  std::shared_ptr<TraceStream<TraceRing<TRACE_SEGMENT_BYTES, TRACE_SEGMENTS> > > stream(new TraceStream<TraceRing<TRACE_SEGMENT_BYTES, TRACE_SEGMENTS> >(controlTrace, CONTROL_PERIOD_MS, MAX_PROBES, TEMP_MEDIAN));
+  AsyncWebServerResponse* response = request->beginChunkedResponse("application/octet-stream", [stream](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+    return stream->read(buffer, maxLen);
+  });
+  response->addHeader("Content-Disposition", "attachment; filename=\"kettle.trace\"");
+  request->send(response);
 }
+#endif
 
-String tempsJSON() {
-  DynamicJsonDocument temps(2048);
-  for(int i = 0; i < tempHistory.size(); i++) {
-    temperature T = tempHistory.get(i);
-    temps["data"][i]["timeLabel"] = T.timeLabel;
-    temps["data"][i]["temp"] = T.temp;
+// Serves one of the pre-gzipped files from webAssets.h straight out of flash
+void serveAsset(AsyncWebServerRequest* request, const webAsset& A) {
+  AsyncWebServerResponse* response;
+  if(request->hasHeader("If-None-Match") && request->header("If-None-Match") == A.etag) {
+    response = request->beginResponse(304);
+  } else {
+    response = request->beginResponse_P(200, A.contentType, A.data, A.len);
+    response->addHeader("Content-Encoding", "gzip");
   }
-
-  String buf;
-  serializeJson(temps, buf);
-  Serial.println(buf);
-  return buf;
+  response->addHeader("ETag", A.etag);
+  response->addHeader("Cache-Control", A.immutable ? "public, max-age=31536000, immutable" : "no-cache");
+  request->send(response);
 }
 
 /*String SendHTML(uint8_t pumpstat, uint8_t heatstat, uint8_t kettle, float temp){
@@ -285,16 +303,6 @@ String tempsJSON() {
   return ptr;
 }*/
 
-String processor(const String& var){
-  if(var == "JSON_DATA"){
-    String jsonData = "";
-    jsonData += "var status = JSON.parse('" + statusJSON() + "');";
-    jsonData += "var temps = JSON.parse('" + tempsJSON() + "');";
-    return jsonData;
-  }
-  return String();
-}
-
 /*void handle_OnConnect() {
   server.send(200, "text/html", SendHTML(pumpStatus, heatStatus, kettleFull, tempReading)); 
 }
@@ -325,29 +333,107 @@ void handle_fillandheat() {
   server.send(200, "text/html", SendHTML(pumpStatus, heatStatus, kettleFull, tempReading));
 }*/
 
-void handle_pumptoggle() {
-  if(pumpStatus == HIGH) {
-    pumpOff();
-  } else {
-    pumpOn();
-  }
-}
-
 /*void handle_NotFound(){
   server.send(404, "text/plain", "Meat bag screwed up!");
 }*/
 
-void notifyClients() {
-  ws.textAll(statusJSON());
+// WebSocket telemetry. loop() watches the state published by the control task and pushes it to every /ws client
+// when it changes, at most once every WS_MIN_INTERVAL_MS so a burst of changes goes out as one frame with the
+// latest state. Each frame is built once and shared by all clients. A client that still has a full send queue
+// is skipped rather than queued more, it gets whatever is newest once it has caught up.
+kettleState lastSentState = {false, false, false, false, 0, {}, TEMP_OK, {}};
+unsigned long lastBroadcast = 0;
+uint32_t lastSentSample = 0;    // tempHistory.count() when the newest sample was last pushed
+bool forceBroadcast = false;    // set to push the status on the next loop() no matter the rate limit
+
+bool stateChanged(const kettleState& a, const kettleState& b) {
+  if(a.pump != b.pump || a.heat != b.heat || a.full != b.full || a.pendingHeat != b.pendingHeat || a.fault != b.fault) {
+    return true;
+  }
+  for(int i = 0; i < probeCount; i++) {
+    if(a.probeFault[i] != b.probeFault[i] || abs(toCentiC(a.probeC[i]) - toCentiC(b.probeC[i])) >= WS_TEMP_DELTA) {
+      return true;
+    }
+  }
+  return abs(toCentiC(a.tempC) - toCentiC(b.tempC)) >= WS_TEMP_DELTA;
+}
+
+void sendFrame(const char* text, size_t len) {   // one copy of the frame, shared by every client that can take it
+  AsyncWebSocketMessageBuffer* buffer = ws.makeBuffer(len);
+  if(buffer == NULL) {
+    return;
+  }
+  memcpy(buffer->get(), text, len);
+  buffer->lock();
+  for(const auto& client : ws.getClients()) {
+    if(client->status() == WS_CONNECTED && client->canSend()) {
+      client->text(buffer);
+    }
+  }
+  buffer->unlock();
+  ws._cleanBuffers();
+}
+
+void notifyClients() {   // Called from loop(), sends whatever changed since the last push
+  if(ws.count() == 0) {
+    return;
+  }
+  unsigned long now = millis();
+  if(!forceBroadcast && now - lastBroadcast < WS_MIN_INTERVAL_MS) {
+    return;   // coalesce, whatever changes in the meantime goes out with the next frame
+  }
+
+  kettleState K = publishedState.read();
+  bool sendStatus = forceBroadcast || stateChanged(K, lastSentState) || now - lastBroadcast >= WS_REFRESH_MS;
+  bool sendSample = tempHistory.count() != lastSentSample;
+  if(!sendStatus && !sendSample) {
+    return;
+  }
+
+  char buf[statusJSONBytes];
+  if(sendStatus) {
+    size_t len = statusJSON(buf, sizeof(buf));
+    if(len > 0) {
+      sendFrame(buf, len);
+    }
+    lastSentState = K;
+  }
+  if(sendSample) {
+    tempSample S;
+    lastSentSample = tempHistory.count();
+    if(tempHistory.read(lastSentSample - 1, S)) {   // only the newest, the page already has the rest
+      size_t len = sampleFrameJSON(buf, sizeof(buf), S);
+      if(len > 0) {
+        sendFrame(buf, len);
+      }
+    }
+  }
+  lastBroadcast = now;
+  forceBroadcast = false;
+}
+
+void notifyAcks() {   // Called from loop(), tells the clients how each command they sent went
+  commandAck A;
+  bool any = false;
+  while(ackQueue.pop(A)) {
+    char buf[128];
+    ackFrameJSON(buf, sizeof(buf), A);
+    ws.textAll(buf);
+    any = true;
+  }
+  if(any) {
+    forceBroadcast = true;    // the client is waiting to see what its command did, skip the rate limit
+  }
 }
 
 void handleWebSocketMessage(void *arg, uint8_t *data, size_t len) {
   AwsFrameInfo *info = (AwsFrameInfo*)arg;
   if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
     data[len] = 0;
-    if (strcmp((char*)data, "pumptoggle") == 0) {
-      handle_pumptoggle();
-      notifyClients();
+    for(int i = 0; i < CMD_COUNT; i++) {
+      if (strcmp((char*)data, commandNames[i]) == 0) {
+        queueCommand((kettleCommandType)i);   // the result comes back as an ack from notifyAcks()
+      }
     }
   }
 }
@@ -357,6 +443,7 @@ void onEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType
   switch (type) {
     case WS_EVT_CONNECT:
       Serial.printf("WebSocket client #%u connected from %s\n", client->id(), client->remoteIP().toString().c_str());
+      forceBroadcast = true;    // bring the new client up to date straight away
       break;
     case WS_EVT_DISCONNECT:
       Serial.printf("WebSocket client #%u disconnected\n", client->id());
@@ -375,14 +462,61 @@ void initWebSocket() {
   server.addHandler(&ws);
 }
 
+void controlTask(void *parameter) {
+  const TickType_t period = pdMS_TO_TICKS(CONTROL_PERIOD_MS);
+  TickType_t lastWake = xTaskGetTickCount();
+  uint32_t expectedStart = micros();
+  for(;;) {
+    uint32_t start = micros();
+    int32_t late = (int32_t)(start - expectedStart);    // signed so micros() rolling over does not matter
+    uint32_t jitter = late < 0 ? -late : late;
+    if(controlStats.ticks > 0 && jitter > controlStats.maxJitterUs) {   // the first pass has nothing to compare against
+      controlStats.maxJitterUs = jitter;
+    }
+
+    controlStep();
+
+    uint32_t runTime = micros() - start;
+    if(runTime > controlStats.maxRunUs) {
+      controlStats.maxRunUs = runTime;
+    }
+    if(runTime > CONTROL_PERIOD_MS * 1000UL) {
+      controlStats.overruns++;
+    }
+    controlStats.ticks++;
+    phaseRecord(PHASE_CONTROL, runTime);
+
+    vTaskDelayUntil(&lastWake, period);
+    expectedStart += CONTROL_PERIOD_MS * 1000UL;   // measured against the ideal schedule so late periods do not hide each other
+  }
+}
+
 void setup() {
   Serial.begin(115200);
   delay(100);
   
-  pinMode(PUMP, OUTPUT);
-  pinMode(FSWITCH, INPUT_PULLUP);
+  halFloatBegin();   // first, so the pump relay pin is an output and the float switch is watched from the start
+  historyGeneration = esp_random() & 0xFFFFFF;
   
-  sensors.begin();
+  if(LittleFS.begin(true)) {   // formats the partition the first time
+    uint32_t restored = historyLog.recover([](const tempSample& S){
+      tempHistory.add(S);   // the control task isn't running yet, so this is still the only writer
+      archiveHistory.add(S);
+      minuteHistory.add(S);
+      quarterHistory.add(S);
+    });
+    historyLogReady = true;
+    Serial.printf("Restored %u temperature readings from flash\n", restored);
+  } else {
+    Serial.println("Failed to mount LittleFS, temperature history will not be saved");
+  }
+
+  controlBegin();
+#ifdef KETTLE_BENCH
+  runBenchmarks();    // before the control task and WiFi start, so nothing else is running
+#endif
+  // The kettle runs whether or not the network comes up, only the web commands need it
+  xTaskCreatePinnedToCore(controlTask, "control", 4096, NULL, CONTROL_PRIORITY, NULL, CONTROL_CORE);
 
   Serial.println("Connecting to ");
   Serial.println(WIFI_NETWORK);
@@ -401,32 +535,70 @@ void setup() {
   Serial.print("Got IP: ");  Serial.println(WiFi.localIP());
 
   if(!MDNS.begin(HOSTNAME)) {
-    Serial.println(F("Error starting mDNS"));
-    return;
+    Serial.println(F("Error starting mDNS, the server is still up on the IP above"));
   }
 
-  kettleArm.attach(SERVO);
-  kettleOff();
-
   //server.on("/", handle_OnConnect);
-  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request){
-    request->send_P(200, F("text/html"), htmlMain, processor);
+  for(size_t i = 0; i < webAssetCount; i++) {   // the page, its script and its stylesheet
+    const webAsset* A = &webAssets[i];
+    server.on(A->path, HTTP_GET, [A](AsyncWebServerRequest *request){
+      serveAsset(request, *A);
+    });
+  }
+  server.on("/status", HTTP_GET, [](AsyncWebServerRequest *request){
+    char buf[statusJSONBytes];
+    if(statusJSON(buf, sizeof(buf)) == 0) {
+      request->send(500, F("application/json"), F("{\"error\":\"status did not fit\"}"));
+      return;
+    }
+    request->send(200, "application/json", buf);
   });
-  //server.on("/pumptoggle", handle_pumptoggle);
-  server.on("/pumptoggle", HTTP_GET, [](AsyncWebServerRequest *request){
-    handle_pumptoggle();
-    request->send(200, F("application/json"), statusJSON());
+  server.on("/history", HTTP_GET, handleHistory);
+  server.on("/api/temps", HTTP_GET, handleTempsSince);
+  server.on("/api/history.bin", HTTP_GET, handleHistoryExport);
+#if TRACE_SEGMENTS > 0
+  server.on("/api/trace", HTTP_GET, handleTrace);
+#endif
+#if PHASE_TIMING
+  server.on("/api/timing", HTTP_GET, [](AsyncWebServerRequest *request){
+    PhaseTimingStream timing;
+    request->send(request->beginChunkedResponse("application/json", [timing](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+      return timing.read(buffer, maxLen);
+    }));
   });
-
-  /*server.on("/heaton", handle_heaton);
-  server.on("/heatoff", handle_heatoff);
-  server.on("/fillandheat", handle_fillandheat);*/
+#endif
+  server.on("/temps", HTTP_GET, [](AsyncWebServerRequest *request){
+    tempsJSON temps(historyFor(request));
+    request->send(request->beginChunkedResponse("application/json", [temps](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+      return temps.read(buffer, maxLen);
+    }));
+  });
+  // /pumpon, /pumpoff, /pumptoggle, /heaton, /heatoff and /fillandheat queue the command and answer with the
+  // status once the control task has run it. The WebSocket clients get an ack for it as well.
+  for(int i = 0; i < CMD_COUNT; i++) {
+    kettleCommandType type = (kettleCommandType)i;
+    server.on((String("/") + commandNames[i]).c_str(), HTTP_GET, [type](AsyncWebServerRequest *request){
+      uint32_t id = queueCommand(type);
+      if(id == 0) {
+        request->send(503, F("application/json"), F("{\"error\":\"busy\"}"));
+        return;
+      }
+      CommandStatusStream status(id);
+      request->send(request->beginChunkedResponse("application/json", [status](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+        if(!status.ready()) {
+          return RESPONSE_TRY_AGAIN;
+        }
+        return status.read(buffer, maxLen);
+      }));
+    });
+  }
   
   //server.onNotFound(handle_NotFound);
   server.onNotFound([](AsyncWebServerRequest *request){
     request->send(404, F("text/plain"), F("Meat bag screwed up!"));
   });
   
+  initWebSocket();
   server.begin();
 
   //init and get the time
@@ -438,41 +610,43 @@ void setup() {
 
 }
 
-void loop() {
-  // 1. Check water level
-  if (isKettleFull()) {           // a. Kettle is full, stop the pump
-    pumpOff();
-    if (pendingHeat) {
-      pendingHeat = false;
-      kettleOn();
+void loop() {   // The Arduino loop only does housekeeping now, the kettle itself is run by controlTask()
+  {
+    PHASE_TIME(PHASE_LOOP);
+    {
+      PHASE_TIME(PHASE_ACKS);
+      notifyAcks();
     }
-  } else {                        // b. Kettle is not full, kill the heat if needed
-    if (heatStatus == HIGH) {
-      kettleOff();
+    {
+      PHASE_TIME(PHASE_NOTIFY);
+      notifyClients();
     }
-    if(pumpStatus == HIGH && (millis() - lastOnPump) >= timeoutPump) {    // c. Safety check, if the pump fails to turn off for a failure of the float switch, leak, or lack of water, it will time out
-      pumpOff();
+    {
+      PHASE_TIME(PHASE_LOG);
+      tempSample S;
+      while(logQueue.pop(S)) {
+        historyLog.append(S);
+      }
     }
-    // Check if we want to refill the kettle later, that is a lower priority action
-  }
-
-  // 2. Check heat
-  sensors.requestTemperatures();
-  tempReading = sensors.getTempCByIndex(0);
-  if(heatStatus == HIGH) {
-    if(tempReading >= targetTemp || (millis() - lastOnHeat) >= timeoutHeat) {   // a. Turn off heat if it is at the target temp or if it has been running for too long
-      kettleOff();
+    {
+      PHASE_TIME(PHASE_CLEANUP);
+      ws.cleanupClients();
     }
   }
-  if((millis() - lastTempRead) >= TEMP_READ_FREQ) {
-    lastTempRead = millis();
-    temperature T = {justTime(), tempReading};
-    tempHistory.add(T);
-    if(tempHistory.size() > NUM_TEMP_READINGS) {
-      tempHistory.remove(0);
+
+  if(millis() - lastStatsReport >= 60000) {
+    lastStatsReport = millis();
+    Serial.printf("Control loop: %u ticks, %u overruns, max run %uus, max jitter %uus\n", controlStats.ticks, controlStats.overruns, controlStats.maxRunUs, controlStats.maxJitterUs);
+    Serial.printf("Temp sensor: %u probes, %u conversions, %u bit, %.3f C/s, bus %uus per cycle (max %uus)\n", probeCount, tempConversions, tempResolution, heatingSlope, lastBusUs, maxBusUs);
+    Serial.printf("Float switch: %u edges, %u pump cuts, max cut %uus\n", floatSwitch.edges, floatSwitch.cuts, floatSwitch.maxCutUs);
+#if PHASE_TIMING
+    Serial.println("Phases since boot:");
+    for(size_t i = 0; i < PHASE_COUNT; i++) {
+      char line[128];
+      phaseLine(line, sizeof(line), i);
+      Serial.println(line);
     }
+#endif
   }
-
-  ws.cleanupClients();
-  
+  delay(10);   // short enough that acks and status pushes reach the clients quickly
 }
\ No newline at end of file
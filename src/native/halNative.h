@@ -0,0 +1,120 @@
+/*
+    hal.h on a PC. There is no hardware, just nativeHw: whatever drives the build (native/main.cpp) sets the
+    clock, the float switch and the probe temperatures in it and reads the pump and arm back out.
+
+    The clock only moves when the driver moves it, so a run is repeatable and can go as fast as the PC allows.
+    nativeSetFloat() does what the float switch interrupt does on the kettle, including cutting the pump.
+*/
+
+#ifndef HAL_NATIVE
+#define HAL_NATIVE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+
+#ifndef HIGH
+#define HIGH 1
+#define LOW 0
+#endif
+
+struct nativeHardware {
+  int64_t nowUs;        // microseconds since boot
+  time_t epochAtBoot;
+  bool pump;            // relay output
+  bool floatLevel;      // HIGH is full
+  int64_t floatEdgeAt;
+  bool floatCut;        // the "interrupt" switched the pump off, not taken by the control logic yet
+  uint32_t floatCuts;
+  int armAngle;
+  uint8_t probes;       // how many probes halProbeBegin() finds
+  float probeC[8];      // what each one would read right now, PROBE_DISCONNECTED_C for a dead one
+  uint8_t resolution;
+  uint32_t conversions;
+  bool quiet;           // drop halLog() output
+};
+nativeHardware nativeHw = {0, 1690000000, false, LOW, 0, false, 0, 0, 1, {20, 20, 20, 20, 20, 20, 20, 20}, 12, 0, false};
+void (*nativeOnOutput)(bool arm, int value) = NULL;   // told about every pump and arm write if set, the replay uses it to check decisions
+
+inline void nativeSetFloat(bool level) {
+  if(level == nativeHw.floatLevel) {
+    return;
+  }
+  nativeHw.floatLevel = level;
+  nativeHw.floatEdgeAt = nativeHw.nowUs;
+  if(level == HIGH && nativeHw.pump) {
+    nativeHw.pump = false;
+    nativeHw.floatCut = true;
+    nativeHw.floatCuts++;
+  }
+}
+
+inline int64_t halMicros() { return nativeHw.nowUs; }
+inline time_t halEpoch() { return nativeHw.epochAtBoot + (time_t)(nativeHw.nowUs / 1000000); }
+
+inline bool halLocalTime(struct tm* t) {
+  time_t now = halEpoch();
+  return gmtime_r(&now, t) != NULL;   // UTC so runs give the same output wherever they are made
+}
+
+inline void halLog(const char* format, ...) {
+  if(nativeHw.quiet) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+inline void halPump(bool on) {
+  nativeHw.pump = on;
+  if(nativeOnOutput) {
+    nativeOnOutput(false, on);
+  }
+}
+
+inline void halFloatBegin() {}
+
+inline bool halFloatTake(bool& level, int64_t& edgeAt) {
+  level = nativeHw.floatLevel;
+  edgeAt = nativeHw.floatEdgeAt;
+  bool cut = nativeHw.floatCut;
+  nativeHw.floatCut = false;
+  return cut;
+}
+
+inline bool halFloatLevel() { return nativeHw.floatLevel; }
+
+inline void halArmBegin() {}
+inline void halArmWrite(int angle) {
+  nativeHw.armAngle = angle;
+  if(nativeOnOutput) {
+    nativeOnOutput(true, angle);
+  }
+}
+
+inline uint8_t halProbeBegin(uint8_t maxProbes) {
+  return nativeHw.probes < maxProbes ? nativeHw.probes : maxProbes;
+}
+
+inline unsigned long halProbeResolution(uint8_t bits) {
+  static const unsigned long conversionMs[] = {94, 188, 375, 750};   // same as DallasTemperature
+  nativeHw.resolution = bits;
+  return conversionMs[bits - 9];
+}
+
+inline void halProbeConvert() { nativeHw.conversions++; }
+
+inline float halProbeRead(uint8_t probe) {   // rounded down to the resolution's step like the DS18B20 does
+  float c = nativeHw.probeC[probe];
+  if(c <= PROBE_DISCONNECTED_C) {
+    return c;
+  }
+  float step = 0.5f / (1 << (nativeHw.resolution - 9));
+  return floorf(c / step) * step;
+}
+
+#endif
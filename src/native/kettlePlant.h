@@ -0,0 +1,153 @@
+/*
+    A simulated kettle for the native build: water mass and temperature, the element, heat loss, the pump,
+    the float switch and the probes, driven through nativeHw from native/halNative.h.
+
+    Call step() once per control period before controlStep(). It reads the pump relay and the kettle arm out of
+    nativeHw and writes the float switch and the probe temperatures back in, the same way the real hardware
+    would see and answer the firmware. The kettle's own switch is latched by the arm pressing to KETTLE_ON or
+    KETTLE_OFF, and like a real kettle it also trips by itself after boiling for a few seconds.
+
+    The physics is a single lump of water: heaterW * efficiency in, lossWPerK * (water - ambient) out, the
+    pump mixes in water at inletC, anything past boilC goes into boiling water off, anything past capacityL
+    spills. Each probe follows the water through a first order lag of sensorTauS with gaussian noise on top.
+*/
+
+#ifndef KETTLE_PLANT
+#define KETTLE_PLANT
+
+#include <stdint.h>
+#include <math.h>
+
+#include "config/userSettings.h"
+#include "native/halNative.h"
+
+struct plantParams {
+  float heaterW;        // element power
+  float efficiency;     // share of it that ends up in the water
+  float lossWPerK;      // heat lost to the room per degree above ambientC
+  float ambientC;
+  float kettleJPerK;    // heat capacity of the kettle itself, on top of the water
+  float capacityL;      // spills over past this
+  float floatL;         // the float switch comes up at this much water
+  float floatDropL;     // and only drops again this much below it
+  float pumpLPerMin;
+  float inletC;         // temperature of the water the pump brings in
+  float startL;         // water already in the kettle, at ambientC
+  float boilC;          // 100 at sea level, about 97 at 1000m
+  float steamTripS;     // the kettle switches itself off after boiling this long
+  float sensorTauS;     // probe time constant
+  float sensorNoiseC;   // standard deviation of the probe noise
+  uint32_t seed;        // for the noise, the same seed gives the same run
+};
+
+const plantParams defaultPlant = {2200, 0.9, 2.0, 20, 400, 1.7, 1.2, 0.05, 1.0, 15, 0, 100, 5, 4, 0.1, 1};
+
+class KettlePlant {
+  public:
+    plantParams P;
+    float waterL;
+    float waterC;
+    float spilledL;
+    float boiledOffL;
+    float peakC;
+    bool element;       // the kettle's own switch
+    float boilingS;     // how long it has been boiling for
+    uint32_t selfTrips; // times the kettle switched itself off
+
+    void begin(const plantParams& params) {
+      P = params;
+      waterL = P.startL;
+      waterC = P.ambientC;
+      spilledL = 0;
+      boiledOffL = 0;
+      peakC = waterC;
+      element = false;
+      boilingS = 0;
+      selfTrips = 0;
+      lastArm = nativeHw.armAngle;
+      rng = P.seed ? P.seed : 1;
+      for(int i = 0; i < 8; i++) {
+        sensedC[i] = waterC;
+        nativeHw.probeC[i] = waterC;
+      }
+      nativeSetFloat(waterL >= P.floatL ? HIGH : LOW);
+    }
+
+    bool floatUp() const {
+      return nativeHw.floatLevel == HIGH ? waterL > P.floatL - P.floatDropL : waterL >= P.floatL;
+    }
+
+    void step(int64_t dtUs) {
+      float dt = dtUs / 1e6f;
+      if(nativeHw.armAngle != lastArm) {    // the arm only does anything on the way to a press
+        if(nativeHw.armAngle == KETTLE_ON) {
+          element = true;
+        } else if(nativeHw.armAngle == KETTLE_OFF) {
+          element = false;
+        }
+        lastArm = nativeHw.armAngle;
+      }
+
+      if(nativeHw.pump) {
+        float inL = P.pumpLPerMin * dt / 60;
+        waterC = (waterC * waterL + P.inletC * inL) / (waterL + inL);
+        waterL += inL;
+        if(waterL > P.capacityL) {
+          spilledL += waterL - P.capacityL;
+          waterL = P.capacityL;
+        }
+      }
+
+      float heatJ = -P.lossWPerK * (waterC - P.ambientC) * dt;
+      bool heating = element && waterL > 0.05f;    // the element is dry below that, the kettle's own dry boil cut out
+      if(heating) {
+        heatJ += P.heaterW * P.efficiency * dt;
+      }
+      waterC += heatJ / (waterL * 4186 + P.kettleJPerK);
+      if(waterC >= P.boilC) {
+        float extraJ = (waterC - P.boilC) * (waterL * 4186 + P.kettleJPerK);
+        float offL = extraJ / 2.26e6f;
+        boiledOffL += offL < waterL ? offL : waterL;
+        waterL -= offL < waterL ? offL : waterL;
+        waterC = P.boilC;
+        boilingS += dt;
+        if(element && boilingS >= P.steamTripS) {
+          element = false;
+          selfTrips++;
+        }
+      } else {
+        boilingS = 0;
+      }
+      if(waterC > peakC) {
+        peakC = waterC;
+      }
+
+      nativeSetFloat(floatUp() ? HIGH : LOW);
+      float follow = dt < P.sensorTauS ? dt / P.sensorTauS : 1;
+      for(int i = 0; i < 8; i++) {
+        if(nativeHw.probeC[i] <= PROBE_DISCONNECTED_C) {
+          continue;   // left alone so a test can unplug a probe
+        }
+        sensedC[i] += (waterC - sensedC[i]) * follow;
+        nativeHw.probeC[i] = sensedC[i] + P.sensorNoiseC * gaussian();
+      }
+    }
+
+  private:
+    int lastArm;
+    float sensedC[8];
+    uint32_t rng;
+
+    float uniform() {   // xorshift32, (0, 1]
+      rng ^= rng << 13;
+      rng ^= rng >> 17;
+      rng ^= rng << 5;
+      return (rng >> 8) / 16777216.0f + 1 / 33554432.0f;
+    }
+
+    float gaussian() {  // Box-Muller
+      return sqrtf(-2 * logf(uniform())) * cosf(6.2831853f * uniform());
+    }
+};
+
+#endif
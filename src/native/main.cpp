@@ -0,0 +1,355 @@
+/*
+    PC build of the kettle: pio run -e native, then run .pio/build/native/program
+
+    Runs the real control logic from kettleControl.h on native/halNative.h instead of the hardware, against
+    the simulated kettle in native/kettlePlant.h. The clock is simulated, so a whole fill and heat takes a few
+    milliseconds and every run gives the same output, which makes it easy to run under the sanitizers (on by
+    default in the native env) or a profiler.
+
+      program          one fill and heat with defaultPlant, with the firmware's log, then what the web side would show
+      program -q       the same without the log
+      program -t file  either of those, and also save the control trace of the run to file
+      program replay file [-v]
+                       replay a control trace (from /api/trace, or -t above) and print every pump and arm decision,
+                       marking any that differ from what was recorded. -v also prints the firmware's log.
+      program sweep    fill and heat across the plants in sweep() below, one CSV line each and a summary. For
+                       checking timeoutPump, timeoutHeat and targetTemp against kettles other than the one on the bench.
+      program bench [baseline]
+                       run the micro-benchmarks in benchmarks.h. With a baseline (bench/native.txt, saved from an earlier
+                       run's output) also compare against it and exit with 1 on a regression. Use the native-bench env
+                       for this, the sanitizers in the native env make every time meaningless.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "kettleControl.h"
+#include "jsonStream.h"
+#include "binaryExport.h"
+#include "native/kettlePlant.h"
+#include "native/traceReplay.h"
+#include "benchmarks.h"
+
+const int64_t stepUs = CONTROL_PERIOD_MS * 1000LL;
+const int64_t commandAtUs = 5000000;    // give the probes time to settle before asking for anything
+
+KettlePlant plant;
+
+struct scenarioResult {
+  bool filled;          // the float switch stopped the pump
+  bool pumpTimedOut;
+  bool heated;          // the heat was turned on at all
+  bool heatTimedOut;
+  float fillS;          // from fill and heat to the pump stopping
+  float heatS;          // from the heat going on to the firmware turning it off
+  float waterL;         // at the end
+  float spilledL;
+  float peakC;          // of the water, not the probe
+  float endC;           // what the control probe read when the heat went off
+  uint32_t selfTrips;   // the kettle switched itself off before the firmware did
+  int64_t simUs;
+};
+
+// One fill and heat from boot. Uses the control logic's globals, so only once per process (see sweep()).
+scenarioResult runScenario(const plantParams& params) {
+  scenarioResult R = {};
+  nativeHw.probes = MAX_PROBES;
+  plant.begin(params);
+  halFloatBegin();
+  controlBegin();
+
+  int64_t pumpOnAt = -1;
+  int64_t heatOnAt = -1;
+  int64_t limitUs = commandAtUs + ((int64_t)timeoutPump + timeoutHeat) * 1000 + 60000000;
+  int64_t t = 0;
+  for(; t < limitUs; t += stepUs) {
+    nativeHw.nowUs = t;
+    if(t == commandAtUs) {
+      queueCommand(CMD_FILL_AND_HEAT);
+    }
+    bool pumpWas = pumpStatus == HIGH;
+    bool heatWas = heatStatus == HIGH;
+    plant.step(stepUs);
+    controlStep();
+    if(!pumpWas && pumpStatus == HIGH) {
+      pumpOnAt = t;
+    } else if(pumpWas && pumpStatus == LOW) {
+      R.fillS = (t - pumpOnAt) / 1e6f;
+      R.filled = halFloatLevel() == HIGH;
+      R.pumpTimedOut = !R.filled && t - pumpOnAt >= (int64_t)timeoutPump * 1000;
+    }
+    if(!heatWas && heatStatus == HIGH) {
+      heatOnAt = t;
+      R.heated = true;
+    } else if(heatWas && heatStatus == LOW) {
+      R.heatS = (t - heatOnAt) / 1e6f;
+      R.heatTimedOut = t - heatOnAt >= (int64_t)timeoutHeat * 1000;
+      R.endC = tempReading;
+    }
+    if(t > commandAtUs && pumpStatus == LOW && heatStatus == LOW && !pendingHeat && armQueue.empty()) {
+      break;    // done, or given up
+    }
+  }
+  R.waterL = plant.waterL;
+  R.spilledL = plant.spilledL;
+  R.peakC = plant.peakC;
+  R.selfTrips = plant.selfTrips;
+  R.simUs = t;
+  return R;
+}
+
+// Runs runScenario() in a child process so every scenario starts from a freshly booted control logic
+bool runIsolated(const plantParams& params, scenarioResult& R) {
+  int fds[2];
+  if(pipe(fds) != 0) {
+    return false;
+  }
+  fflush(stdout);
+  pid_t pid = fork();
+  if(pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if(pid == 0) {
+    close(fds[0]);
+    nativeHw.quiet = true;
+    scenarioResult child = runScenario(params);
+    ssize_t n = write(fds[1], &child, sizeof(child));
+    _exit(n == sizeof(child) ? 0 : 1);
+  }
+  close(fds[1]);
+  ssize_t n = read(fds[0], &R, sizeof(R));
+  close(fds[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  return n == sizeof(R) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+double wallSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int sweep() {
+  // Every combination of these, on top of defaultPlant
+  const float heaterW[] = {1500, 2200, 3000};
+  const float floatL[] = {0.8, 1.2, 1.6};
+  const float pumpLPerMin[] = {0.3, 1.0, 2.0};
+  const float inletC[] = {8, 20};
+  const float boilC[] = {100, 97};
+  const float sensorTauS[] = {2, 10};
+  const float sensorNoiseC[] = {0.02, 0.1};   // a DS18B20 is nowhere near 0.2, and past that the filter's slew check starts tripping
+#define COUNT(a) (sizeof(a) / sizeof(a[0]))
+
+  printf("heaterW,floatL,pumpLPerMin,inletC,boilC,sensorTauS,sensorNoiseC,filled,pumpTimedOut,fillS,heated,heatTimedOut,heatS,waterL,spilledL,peakC,endC,selfTrips\n");
+  uint32_t runs = 0, failed = 0, notFilled = 0, heatTimeouts = 0, spills = 0, selfTripped = 0;
+  float worstFillS = 0, worstHeatS = 0, worstPeakC = 0;
+  double simS = 0;
+  double started = wallSeconds();
+  for(size_t a = 0; a < COUNT(heaterW); a++)
+  for(size_t b = 0; b < COUNT(floatL); b++)
+  for(size_t c = 0; c < COUNT(pumpLPerMin); c++)
+  for(size_t d = 0; d < COUNT(inletC); d++)
+  for(size_t e = 0; e < COUNT(boilC); e++)
+  for(size_t f = 0; f < COUNT(sensorTauS); f++)
+  for(size_t g = 0; g < COUNT(sensorNoiseC); g++) {
+    plantParams P = defaultPlant;
+    P.heaterW = heaterW[a];
+    P.floatL = floatL[b];
+    P.pumpLPerMin = pumpLPerMin[c];
+    P.inletC = inletC[d];
+    P.boilC = boilC[e];
+    P.sensorTauS = sensorTauS[f];
+    P.sensorNoiseC = sensorNoiseC[g];
+    P.seed = runs + 1;
+    runs++;
+    scenarioResult R;
+    if(!runIsolated(P, R)) {
+      failed++;
+      printf("# run %u failed\n", runs);
+      continue;
+    }
+    printf("%.0f,%.1f,%.1f,%.0f,%.0f,%.0f,%.2f,%d,%d,%.1f,%d,%d,%.1f,%.3f,%.3f,%.2f,%.2f,%u\n",
+           P.heaterW, P.floatL, P.pumpLPerMin, P.inletC, P.boilC, P.sensorTauS, P.sensorNoiseC,
+           R.filled, R.pumpTimedOut, R.fillS, R.heated, R.heatTimedOut, R.heatS, R.waterL, R.spilledL, R.peakC, R.endC, R.selfTrips);
+    simS += R.simUs / 1e6;
+    notFilled += !R.filled;
+    heatTimeouts += R.heatTimedOut;
+    spills += R.spilledL > 0;
+    selfTripped += R.selfTrips > 0;
+    worstFillS = R.fillS > worstFillS ? R.fillS : worstFillS;
+    worstHeatS = R.heatS > worstHeatS ? R.heatS : worstHeatS;
+    worstPeakC = R.peakC > worstPeakC ? R.peakC : worstPeakC;
+  }
+  double wallS = wallSeconds() - started;
+
+  printf("# %u scenarios, %u failed to run\n", runs, failed);
+  printf("# not filled: %u (pump timeout %.0fs), longest fill %.1fs\n", notFilled, timeoutPump / 1000.0, worstFillS);
+  printf("# heat timed out: %u (timeout %.0fs, target %.1fC), longest heat %.1fs\n", heatTimeouts, timeoutHeat / 1000.0, targetTemp, worstHeatS);
+  printf("# kettle switched itself off first: %u, spilled: %u, hottest water %.2fC\n", selfTripped, spills, worstPeakC);
+  printf("# %.0fs simulated in %.2fs, %.0fx real time\n", simS, wallS, wallS > 0 ? simS / wallS : 0);
+  return failed ? 1 : 0;
+}
+
+#if TRACE_SEGMENTS > 0
+int replay(const char* path, bool verbose) {
+  FILE* in = fopen(path, "rb");
+  if(in == NULL) {
+    fprintf(stderr, "Can't open %s\n", path);
+    return 1;
+  }
+  std::vector<uint8_t> data;
+  uint8_t buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+  fclose(in);
+
+  nativeHw.quiet = !verbose;
+  TraceReplay R(stdout);
+  double started = wallSeconds();
+  if(!R.run(data.data(), data.size())) {
+    return 1;
+  }
+  double wallS = wallSeconds() - started;
+  const replayStats& S = R.stats();
+  printf("# %u steps (%.1fs) from %u segments in %.3fs, %u restarts, %u decisions, %u differences\n",
+         S.steps, S.steps * CONTROL_PERIOD_MS / 1000.0, S.segments, wallS, S.restarts, S.outputs, S.differences);
+  return S.differences ? 2 : 0;
+}
+
+bool saveTrace(const char* path) {
+  FILE* out = fopen(path, "wb");
+  if(out == NULL) {
+    fprintf(stderr, "Can't write %s\n", path);
+    return false;
+  }
+  TraceStream<TraceRing<TRACE_SEGMENT_BYTES, TRACE_SEGMENTS> > trace(controlTrace, CONTROL_PERIOD_MS, MAX_PROBES, TEMP_MEDIAN);
+  uint8_t buf[1024];
+  size_t n;
+  while((n = trace.read(buf, sizeof(buf))) > 0) {
+    fwrite(buf, 1, n, out);
+  }
+  return fclose(out) == 0;
+}
+#endif
+
+int bench(const char* baselinePath) {
+  std::vector<benchResult> base;
+  if(baselinePath != NULL) {
+    FILE* in = fopen(baselinePath, "r");
+    if(in == NULL) {
+      fprintf(stderr, "Can't open %s\n", baselinePath);
+      return 1;
+    }
+    char line[256];
+    benchResult B;
+    while(fgets(line, sizeof(line), in) != NULL) {
+      if(benchParse(line, B)) {
+        base.push_back(B);
+      }
+    }
+    fclose(in);
+  }
+
+  nativeHw.quiet = true;
+  nativeHw.probes = MAX_PROBES;
+  halFloatBegin();
+  controlBegin();
+  benchResult results[benchCaseCount];
+  runBenchmarks(results);
+  if(baselinePath == NULL) {
+    return 0;
+  }
+
+  int regressions = 0;
+  printf("# against %s, more than %.0f%% slower or any more allocation is a regression\n", baselinePath, benchSlower * 100);
+  for(size_t i = 0; i < benchCaseCount; i++) {
+    char line[128];
+    bool found = false;
+    for(size_t j = 0; j < base.size() && !found; j++) {
+      if(strcmp(base[j].name, results[i].name) == 0) {
+        found = true;
+        regressions += benchCompare(results[i], base[j], line, sizeof(line));
+        printf("# %s\n", line);
+      }
+    }
+    if(!found) {
+      printf("# %-18s not in the baseline\n", results[i].name);
+    }
+  }
+  printf("# %d regressions\n", regressions);
+  return regressions ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+  if(argc > 1 && strcmp(argv[1], "sweep") == 0) {
+    return sweep();
+  }
+  if(argc > 1 && strcmp(argv[1], "bench") == 0) {
+    return bench(argc > 2 ? argv[2] : NULL);
+  }
+#if TRACE_SEGMENTS > 0
+  if(argc > 2 && strcmp(argv[1], "replay") == 0) {
+    return replay(argv[2], argc > 3 && strcmp(argv[3], "-v") == 0);
+  }
+#endif
+  const char* tracePath = NULL;
+  for(int i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "-q") == 0) {
+      nativeHw.quiet = true;
+    } else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      tracePath = argv[++i];
+    }
+  }
+
+  double started = wallSeconds();
+  scenarioResult R = runScenario(defaultPlant);
+  double wallS = wallSeconds() - started;
+
+  printf("fill: %s after %.1fs, %.3fL in the kettle, %.3fL spilled\n", R.filled ? "full" : (R.pumpTimedOut ? "pump timed out" : "stopped"), R.fillS, R.waterL, R.spilledL);
+  printf("heat: %s after %.1fs at %.2fC, water peaked at %.2fC%s\n", R.heatTimedOut ? "timed out" : "off", R.heatS, R.endC, R.peakC, R.selfTrips ? ", the kettle switched itself off first" : "");
+  printf("%u conversions, %u pump cuts by the float switch, %.1fs simulated in %.3fs\n", nativeHw.conversions, nativeHw.floatCuts, R.simUs / 1e6, wallS);
+
+  char buf[statusJSONBytes];
+  if(statusJSON(buf, sizeof(buf)) == 0) {
+    printf("status: did not fit in statusJSONBytes\n");
+  } else {
+    printf("status: %s\n", buf);
+  }
+
+  TempsJSONStream<SampleHistory<NUM_TEMP_READINGS> > temps(tempHistory);
+  size_t n;
+  printf("temps: ");
+  while((n = temps.read((uint8_t*)buf, sizeof(buf) - 1)) > 0) {
+    fwrite(buf, 1, n, stdout);
+  }
+  printf("\n");
+
+  BinaryHistoryStream<CompressedHistory<HISTORY_ARCHIVE_BLOCK_BYTES, HISTORY_ARCHIVE_BLOCKS> > binary(archiveHistory, TEMP_READ_FREQ / 1000, 0, false);
+  size_t total = 0;
+  while((n = binary.read((uint8_t*)buf, sizeof(buf))) > 0) {
+    total += n;
+  }
+  printf("binary history export: %u bytes\n", (unsigned)total);
+
+#if TRACE_SEGMENTS > 0
+  if(tracePath != NULL) {
+    if(!saveTrace(tracePath)) {
+      return 1;
+    }
+    printf("control trace saved to %s\n", tracePath);
+  }
+#else
+  if(tracePath != NULL) {
+    printf("TRACE_SEGMENTS is 0, there is no control trace to save\n");
+  }
+#endif
+  return 0;
+}
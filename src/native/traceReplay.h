@@ -0,0 +1,272 @@
+/*
+    Replays a control trace (controlTrace.h, downloaded from /api/trace) through the control logic as fast as
+    the PC goes.
+
+    The control state is restored from the first keyframe, then every recorded step is run with the recorded
+    time, probe readings, float switch and commands put into nativeHw and commandQueue just before it. Steps
+    the trace left out ran on schedule with nothing to record, so they are run at their nominal time with no
+    new input. Every pump and arm write the replay makes is printed and checked against the ones recorded at the
+    same step, so two builds replaying the same trace can be diffed line by line.
+
+    A keyframe that carries on from the previous segment is also checked against the replayed state. Where the
+    trace has a gap (a segment was reused, or records were dropped) the replay starts again from the keyframe.
+*/
+
+#ifndef TRACE_REPLAY
+#define TRACE_REPLAY
+
+#include <stdio.h>
+#include <vector>
+
+#include "kettleControl.h"
+
+#if TRACE_SEGMENTS > 0
+
+struct replayOutput {
+  bool arm;     // the arm to an angle, or the pump relay on or off
+  int value;
+};
+
+struct replayStats {
+  uint32_t segments;
+  uint32_t restarts;    // keyframes the replay had to start again from
+  uint32_t steps;
+  uint32_t outputs;
+  uint32_t differences; // steps whose outputs did not match, and keyframes the replayed state did not match
+};
+
+class TraceReplay {
+  public:
+    TraceReplay(FILE* out) : _out(out), _booted(false), _haveStep(false), _step(0), _stepAt(0) {
+      _stats = replayStats();
+    }
+
+    // Returns false if the trace can't be replayed by this build at all
+    bool run(const uint8_t* data, size_t len) {
+      if(len < 8 || memcmp(data, "TBKT", 4) != 0) {
+        fprintf(_out, "not a control trace\n");
+        return false;
+      }
+      if(data[4] != CONTROL_TRACE_VERSION || data[5] != CONTROL_PERIOD_MS || data[6] != MAX_PROBES || data[7] != TEMP_MEDIAN) {
+        fprintf(_out, "trace is version %u with CONTROL_PERIOD_MS %u, MAX_PROBES %u, TEMP_MEDIAN %u, this build needs %u, %u, %u, %u\n",
+                data[4], data[5], data[6], data[7], CONTROL_TRACE_VERSION, CONTROL_PERIOD_MS, MAX_PROBES, TEMP_MEDIAN);
+        return false;
+      }
+      current = this;
+      nativeOnOutput = collect;
+      size_t pos = 8;
+      while(pos + 2 <= len) {
+        size_t segLen = data[pos] | data[pos + 1] << 8;
+        pos += 2;
+        if(pos + segLen > len) {
+          fprintf(_out, "trace is cut short\n");
+          break;
+        }
+        segment(data + pos, segLen);
+        pos += segLen;
+      }
+      finishStep();
+      nativeOnOutput = NULL;
+      return true;
+    }
+
+    const replayStats& stats() const { return _stats; }
+
+  private:
+    struct input {
+      traceRecordType type;
+      uint8_t hi;       // the high bits of the type byte
+      int32_t a;
+      uint32_t b;
+    };
+
+    void segment(const uint8_t* data, size_t len) {
+      traceUnpacker U(data, len);
+      if((U.u8() & 0x0F) != TRACE_KEYFRAME) {
+        fprintf(_out, "segment without a keyframe, skipped\n");
+        return;
+      }
+      _stats.segments++;
+      uint32_t step = U.u32();
+      int64_t at = U.u64();
+      uint32_t epoch = U.u32();
+      uint8_t flags = U.u8();
+
+      finishStep();
+      bool restore = !_booted || !(flags & TRACE_CONTINUES) || step <= _step;
+      if(!restore) {
+        runNominal(step, _markAt);
+        tracePacker<sizeof(traceKeyframeBuf.buf)> live;
+        traceSnapshot(live);
+        if(live.len <= (size_t)(U.end - U.p) && memcmp(live.buf, U.p, live.len) == 0) {
+          U.p += live.len;
+        } else {
+          fprintf(_out, "%10.3fs  step %u  replayed state differs from the keyframe, carrying on from the keyframe\n", at / 1e6, step);
+          _stats.differences++;
+          restore = true;
+        }
+      } else if(_booted) {
+        fprintf(_out, "%10.3fs  step %u  gap in the trace, starting again from the keyframe\n", at / 1e6, step);
+        _stats.restarts++;
+      }
+      if(restore) {
+        if(!_booted) {
+          nativeHw.probes = MAX_PROBES;
+          halFloatBegin();
+          controlBegin();
+          _booted = true;
+        }
+        traceRestore(U);
+        nativeHw.pump = pumpStatus;
+        nativeHw.floatLevel = traceFloatLevel;
+        nativeHw.floatEdgeAt = traceFloatEdgeAt;
+        nativeHw.floatCut = false;
+        nativeHw.resolution = tempResolution;
+        nativeHw.epochAtBoot = epoch - (time_t)(at / 1000000);
+        traceStepCount = step - 1;    // so the replay's own trace numbers its steps the same
+      }
+      startStep(step, at);
+      _markAt = at;
+
+      while(U.ok() && !U.done()) {
+        uint8_t t = U.u8();
+        input I = {(traceRecordType)(t & 0x0F), (uint8_t)(t >> 4), 0, 0};
+        switch(I.type) {
+          case TRACE_STEP: {
+            uint32_t steps = U.varint();
+            int32_t offUs = U.zigzag();
+            finishStep();
+            runNominal(_step + steps, _markAt);
+            _markAt += (int64_t)steps * CONTROL_PERIOD_MS * 1000 + offUs;
+            startStep(_step + 1, _markAt);
+            break;
+          }
+          case TRACE_PROBE:
+            I.a = (int16_t)U.u16();
+            _inputs.push_back(I);
+            break;
+          case TRACE_FLOAT:
+            I.a = U.zigzag();
+            _inputs.push_back(I);
+            break;
+          case TRACE_COMMAND:
+            I.b = U.varint();
+            I.a = U.varint();
+            _inputs.push_back(I);
+            break;
+          case TRACE_PUMP: {
+            replayOutput O = {false, I.hi & 1};
+            _expected.push_back(O);
+            break;
+          }
+          case TRACE_ARM: {
+            replayOutput O = {true, (int)U.varint()};
+            _expected.push_back(O);
+            break;
+          }
+          default:
+            fprintf(_out, "unknown record %u, rest of the segment skipped\n", I.type);
+            return;
+        }
+      }
+      if(!U.ok()) {
+        fprintf(_out, "segment cut short\n");
+      }
+    }
+
+    // Runs the steps after _step up to (not including) until, which recorded nothing so ran on schedule
+    void runNominal(uint32_t until, int64_t fromAt) {
+      int64_t markStep = _step;
+      while(_step + 1 < until) {
+        startStep(_step + 1, fromAt + (int64_t)(_step + 1 - markStep) * CONTROL_PERIOD_MS * 1000);
+        finishStep();
+      }
+    }
+
+    void startStep(uint32_t step, int64_t at) {
+      _step = step;
+      _stepAt = at;
+      _haveStep = true;
+    }
+
+    void finishStep() {   // Runs the step with its inputs and checks the outputs
+      if(!_haveStep) {
+        return;
+      }
+      _haveStep = false;
+      for(size_t i = 0; i < _inputs.size(); i++) {
+        const input& I = _inputs[i];
+        if(I.type == TRACE_PROBE) {
+          nativeHw.probeC[I.hi] = I.a / 128.0f;
+        } else if(I.type == TRACE_FLOAT) {
+          nativeHw.floatLevel = I.hi & 1;
+          nativeHw.floatEdgeAt = _stepAt + I.a;
+          if(I.hi & 2) {
+            nativeHw.floatCut = true;   // what the interrupt does on the kettle
+            nativeHw.pump = false;
+          }
+        } else if(I.type == TRACE_COMMAND) {
+          kettleCommand C = {(kettleCommandType)I.hi, I.b, (uint32_t)_stepAt - (uint32_t)I.a};
+          commandQueue.push(C);
+        }
+      }
+      nativeHw.nowUs = _stepAt;
+      _outputs.clear();
+      controlStep();
+      _stats.steps++;
+      _stats.outputs += _outputs.size();
+
+      bool same = _outputs.size() == _expected.size();
+      for(size_t i = 0; same && i < _outputs.size(); i++) {
+        same = _outputs[i].arm == _expected[i].arm && _outputs[i].value == _expected[i].value;
+      }
+      if(!_outputs.empty() || !same) {
+        fprintf(_out, "%10.3fs  step %u ", _stepAt / 1e6, _step);
+        describe(_outputs);
+        if(!same) {
+          fprintf(_out, "  << recorded:");
+          describe(_expected);
+          _stats.differences++;
+        }
+        fprintf(_out, "\n");
+      }
+      _inputs.clear();
+      _expected.clear();
+    }
+
+    void describe(const std::vector<replayOutput>& outputs) {
+      if(outputs.empty()) {
+        fprintf(_out, " nothing");
+      }
+      for(size_t i = 0; i < outputs.size(); i++) {
+        if(outputs[i].arm) {
+          fprintf(_out, " arm %d", outputs[i].value);
+        } else {
+          fprintf(_out, " pump %s", outputs[i].value ? "on" : "off");
+        }
+      }
+    }
+
+    static void collect(bool arm, int value) {
+      replayOutput O = {arm, value};
+      current->_outputs.push_back(O);
+    }
+
+    static TraceReplay* current;    // for collect(), nativeOnOutput is a plain function pointer
+
+    FILE* _out;
+    bool _booted;
+    bool _haveStep;     // _step has been started but not run yet
+    uint32_t _step;
+    int64_t _stepAt;
+    int64_t _markAt;    // time of the last recorded step, the steps left out after it are timed from here
+    std::vector<input> _inputs;
+    std::vector<replayOutput> _expected;
+    std::vector<replayOutput> _outputs;
+    replayStats _stats;
+};
+
+TraceReplay* TraceReplay::current = NULL;
+
+#endif
+#endif
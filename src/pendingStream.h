@@ -0,0 +1,48 @@
+/*
+    The read() every streamed response shares.
+
+    A stream works a piece at a time: refill() puts the next piece of output in _pending (one sample, say) and
+    read() copies it out into whatever buffer the chunked response hands over, calling refill() again whenever
+    it runs dry. Only refill() differs from one stream to the next, so each one derives from
+    PendingStream<itself, bytes of _pending> and provides that:
+      bool refill()   sets _len (and _pos to 0) for the next piece, returns false once the output is complete
+    The base calls it through the derived type, so there is no virtual call and the whole read() inlines.
+*/
+
+#ifndef PENDING_STREAM
+#define PENDING_STREAM
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+template<typename Derived, size_t Bytes, typename Byte = char>
+class PendingStream {
+public:
+  // Fills buf with up to maxLen bytes of output, returns how many were written. 0 means the output is complete.
+  size_t read(uint8_t* buf, size_t maxLen) {
+    size_t written = 0;
+    while(written < maxLen) {
+      if(_pos == _len && !static_cast<Derived*>(this)->refill()) {
+        break;
+      }
+      size_t n = _len - _pos;
+      if(n > maxLen - written) {
+        n = maxLen - written;
+      }
+      memcpy(buf + written, _pending + _pos, n);
+      _pos += n;
+      written += n;
+    }
+    return written;
+  }
+
+protected:
+  PendingStream() : _len(0), _pos(0) {}
+
+  Byte _pending[Bytes];   // the piece of output currently being copied out
+  size_t _len;
+  size_t _pos;
+};
+
+#endif
@@ -0,0 +1,220 @@
+/*
+    How long each phase of controlStep() and loop() takes, so a slow pass can be pinned on the float check,
+    the temperature conversion, the history update, a WebSocket cleanup and so on.
+
+    PHASE_TIME(phase) at the top of a block times the rest of the block into that phase's PhaseHistogram, a
+    fixed array of log scale buckets plus the exact min and max and a count of passes over the phase's budget.
+    There are two buckets per power of two, splitting it in half: [2^k, 1.5 * 2^k) and [1.5 * 2^k, 2^(k+1)). A
+    percentile is the top of its bucket, so it is never under the real value and at most 50% over it (a time
+    just over 2^k reported as nearly 1.5 * 2^k). Recording is a couple of halMicros() calls and a few adds, no
+    locks and no heap; each phase is only ever written by one task and readers put up with a torn bucket now
+    and then. With PHASE_TIMING set to 0 in userSettings.h the macro is empty and none of this is compiled in.
+
+    Read from /api/timing, and printed on the serial console with the rest of loop()'s report:
+      {"phases":[{"name":"float","count":6000,"minus":2,"p50us":3,"p99us":11,"maxus":40,"budgetus":10000,"overruns":0},...]}
+*/
+
+#ifndef PHASE_TIMING_H
+#define PHASE_TIMING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config/userSettings.h"
+#include "hal.h"
+#include "pendingStream.h"
+
+// Bucket b holds [bucketLow(b), bucketLow(b + 1)) microseconds, the last one everything from 3 * 2^22 (12.6s) up
+class PhaseHistogram {
+public:
+  static const size_t BUCKETS = 48;
+
+  PhaseHistogram() { reset(); }
+
+  void reset() {
+    _count = 0;
+    _overruns = 0;
+    _minUs = UINT32_MAX;
+    _maxUs = 0;
+    memset(_buckets, 0, sizeof(_buckets));
+  }
+
+  void add(uint32_t us, uint32_t budgetUs) {
+    _buckets[bucketOf(us)]++;
+    _count++;
+    if(us > budgetUs) {
+      _overruns++;
+    }
+    if(us < _minUs) {
+      _minUs = us;
+    }
+    if(us > _maxUs) {
+      _maxUs = us;
+    }
+  }
+
+  uint32_t count() const { return _count; }
+  uint32_t overruns() const { return _overruns; }
+  uint32_t minUs() const { return _count ? _minUs : 0; }
+  uint32_t maxUs() const { return _maxUs; }
+
+  // The top of the bucket the fraction p (0 to 1) of the passes are at or below, kept between min and max
+  uint32_t percentileUs(float p) const {
+    uint32_t total = 0;
+    for(size_t b = 0; b < BUCKETS; b++) {
+      total += _buckets[b];   // not _count, the buckets are what is being walked
+    }
+    if(total == 0) {
+      return 0;
+    }
+    uint32_t rank = (uint32_t)(p * total + 0.5f);
+    if(rank < 1) {
+      rank = 1;
+    }
+    uint32_t seen = 0;
+    for(size_t b = 0; b < BUCKETS; b++) {
+      seen += _buckets[b];
+      if(seen >= rank) {
+        uint32_t us = b + 1 < BUCKETS ? bucketLow(b + 1) - 1 : _maxUs;
+        return us < _minUs ? _minUs : (us > _maxUs ? _maxUs : us);
+      }
+    }
+    return _maxUs;
+  }
+
+  static size_t bucketOf(uint32_t us) {
+    if(us < 2) {
+      return us;
+    }
+    int msb = 31 - __builtin_clz(us);
+    size_t b = 2 * msb + ((us >> (msb - 1)) & 1);   // the bit below the top one picks the half of the octave
+    return b < BUCKETS ? b : BUCKETS - 1;
+  }
+
+  static uint32_t bucketLow(size_t b) {
+    if(b < 2) {
+      return b;
+    }
+    return (uint32_t)(2 | (b & 1)) << (b / 2 - 1);
+  }
+
+private:
+  uint32_t _count;
+  uint32_t _overruns;
+  uint32_t _minUs;
+  uint32_t _maxUs;
+  uint32_t _buckets[BUCKETS];
+};
+
+enum timedPhases {
+  PHASE_CONTROL,        // the whole of controlStep(), timed by controlTask()
+  PHASE_COMMANDS,       // the rest are parts of it
+  PHASE_FLOAT,
+  PHASE_TEMPERATURE,    // reading the probes and starting the next conversion
+  PHASE_HISTORY,        // storing a reading, once every TEMP_READ_FREQ
+  PHASE_ARM,
+  PHASE_PUBLISH,
+  PHASE_LOOP,           // one pass of loop() without its delay()
+  PHASE_ACKS,           // and its parts
+  PHASE_NOTIFY,
+  PHASE_LOG,            // saving readings to flash
+  PHASE_CLEANUP,        // ws.cleanupClients()
+  PHASE_COUNT
+};
+
+struct phaseInfo {
+  const char* name;
+  uint32_t budgetUs;    // a pass longer than this counts as an overrun
+};
+
+const uint32_t loopBudgetUs = 20000;   // longer than this and acks and status pushes start to lag noticeably
+
+const phaseInfo phaseInfos[PHASE_COUNT] = {
+  {"control", CONTROL_PERIOD_MS * 1000UL},
+  {"commands", CONTROL_PERIOD_MS * 1000UL},
+  {"float", CONTROL_PERIOD_MS * 1000UL},
+  {"temperature", CONTROL_PERIOD_MS * 1000UL},
+  {"history", CONTROL_PERIOD_MS * 1000UL},
+  {"arm", CONTROL_PERIOD_MS * 1000UL},
+  {"publish", CONTROL_PERIOD_MS * 1000UL},
+  {"loop", loopBudgetUs},
+  {"acks", loopBudgetUs},
+  {"notify", loopBudgetUs},
+  {"log", loopBudgetUs},
+  {"cleanup", loopBudgetUs}
+};
+
+#if PHASE_TIMING
+PhaseHistogram phaseTimes[PHASE_COUNT];
+
+inline void phaseRecord(timedPhases phase, uint32_t us) {
+  phaseTimes[phase].add(us, phaseInfos[phase].budgetUs);
+}
+
+class PhaseScope {
+public:
+  PhaseScope(timedPhases phase) : _phase(phase), _start(halMicros()) {}
+  ~PhaseScope() { phaseRecord(_phase, (uint32_t)(halMicros() - _start)); }
+
+private:
+  timedPhases _phase;
+  int64_t _start;
+};
+
+#define PHASE_TIME_JOIN(a, b) a##b
+#define PHASE_TIME_NAME(line) PHASE_TIME_JOIN(phaseScope, line)
+#define PHASE_TIME(phase) PhaseScope PHASE_TIME_NAME(__LINE__)(phase)
+
+// One phase as JSON, for /api/timing. Returns the length like snprintf.
+int phaseJSON(char* buf, size_t len, size_t phase) {
+  const PhaseHistogram& H = phaseTimes[phase];
+  return snprintf(buf, len, "{\"name\":\"%s\",\"count\":%u,\"minus\":%u,\"p50us\":%u,\"p99us\":%u,\"maxus\":%u,\"budgetus\":%u,\"overruns\":%u}",
+                  phaseInfos[phase].name, H.count(), H.minUs(), H.percentileUs(0.5f), H.percentileUs(0.99f), H.maxUs(),
+                  phaseInfos[phase].budgetUs, H.overruns());
+}
+
+// One phase as a line for the serial console
+int phaseLine(char* buf, size_t len, size_t phase) {
+  const PhaseHistogram& H = phaseTimes[phase];
+  return snprintf(buf, len, "  %-12s %8u passes  min %6uus  p50 %6uus  p99 %6uus  max %7uus  %u over %uus",
+                  phaseInfos[phase].name, H.count(), H.minUs(), H.percentileUs(0.5f), H.percentileUs(0.99f), H.maxUs(),
+                  H.overruns(), phaseInfos[phase].budgetUs);
+}
+
+// /api/timing a phase at a time, like the other streams
+class PhaseTimingStream : public PendingStream<PhaseTimingStream, 192> {
+  friend class PendingStream<PhaseTimingStream, 192>;
+
+public:
+  PhaseTimingStream() : _phase(0) {
+    _len = snprintf(_pending, sizeof(_pending), "{\"phases\":[");
+  }
+
+private:
+  bool refill() {
+    if(_phase > PHASE_COUNT) {
+      return false;
+    }
+    _pos = 0;
+    if(_phase == PHASE_COUNT) {
+      _len = snprintf(_pending, sizeof(_pending), "]}");
+    } else {
+      size_t comma = _phase > 0;
+      _pending[0] = ',';
+      int n = phaseJSON(_pending + comma, sizeof(_pending) - comma, _phase);
+      _len = comma + (n < (int)(sizeof(_pending) - comma) ? n : sizeof(_pending) - comma - 1);
+    }
+    _phase++;
+    return true;
+  }
+
+  size_t _phase;    // next one to write, PHASE_COUNT for the closing bracket
+};
+#else
+inline void phaseRecord(timedPhases, uint32_t) {}
+#define PHASE_TIME(phase)
+#endif
+
+#endif
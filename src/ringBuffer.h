@@ -0,0 +1,79 @@
+/*
+    Fixed-capacity circular buffer used for the temperature history.
+
+    Storage is a plain array sized at compile time, so once the firmware has booted nothing in here
+    touches the heap. push() is O(1) and overwrites the oldest entry when full, which is exactly what the
+    history needs (the old ListLinked did a new/delete and an O(n) walk every TEMP_READ_FREQ).
+    Index 0 is always the oldest entry, size()-1 the newest.
+*/
+
+#ifndef RING_BUFFER
+#define RING_BUFFER
+
+#include <stddef.h>
+
+template<typename T, size_t N>
+class RingBuffer {
+  static_assert(N > 0, "RingBuffer needs a capacity of at least one");
+
+public:
+  class const_iterator {
+  public:
+    const_iterator(const RingBuffer* buf, size_t pos) : _buf(buf), _pos(pos) {}
+    const T& operator*() const { return (*_buf)[_pos]; }
+    const T* operator->() const { return &(*_buf)[_pos]; }
+    const_iterator& operator++() { _pos++; return *this; }
+    bool operator!=(const const_iterator& other) const { return _pos != other._pos; }
+    bool operator==(const const_iterator& other) const { return _pos == other._pos; }
+  private:
+    const RingBuffer* _buf;
+    size_t _pos;
+  };
+
+  RingBuffer() : _head(0), _size(0) {}
+
+  static constexpr size_t capacity() { return N; }
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  bool full() const { return _size == N; }
+
+  // Appends to the back. Returns true if the oldest entry had to be evicted to make room.
+  bool push(const T& item) {
+    _data[(_head + _size) % N] = item;
+    if(_size < N) {
+      _size++;
+      return false;
+    }
+    _head = (_head + 1) % N;   // buffer was full, the slot we just wrote was the oldest one
+    return true;
+  }
+
+  // Drops the oldest entry, returns false if there was nothing to drop
+  bool pop() {
+    if(_size == 0) return false;
+    _head = (_head + 1) % N;
+    _size--;
+    return true;
+  }
+
+  void clear() { _head = 0; _size = 0; }
+
+  // No bounds checking, same as a plain array. 0 is the oldest entry.
+  const T& operator[](size_t i) const { return _data[(_head + i) % N]; }
+  T& operator[](size_t i) { return _data[(_head + i) % N]; }
+
+  T& front() { return (*this)[0]; }
+  const T& front() const { return (*this)[0]; }
+  T& back() { return (*this)[_size - 1]; }
+  const T& back() const { return (*this)[_size - 1]; }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, _size); }
+
+private:
+  T _data[N];
+  size_t _head;   // index of the oldest entry
+  size_t _size;
+};
+
+#endif
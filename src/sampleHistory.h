@@ -0,0 +1,92 @@
+/*
+    Temperature history shared between the control task (the only writer) and the web server (readers).
+
+    Works like RingBuffer but every sample gets a sequence number that keeps counting up, so a reader can
+    ask for a sample by number and find out whether it is still there. Readers never lock and never stop
+    the writer. If the writer overwrites a slot while a reader is copying it, the reader is told the sample
+    is gone instead of getting half of an old sample and half of a new one.
+    T defaults to tempSample, the rolled up history tiers use it with tempBucket.
+*/
+
+#ifndef SAMPLE_HISTORY
+#define SAMPLE_HISTORY
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include "tempSample.h"
+
+template<size_t N, typename T = tempSample>
+class SampleHistory {
+  static_assert(N > 0, "SampleHistory needs a capacity of at least one");
+
+public:
+  typedef T item;
+
+  SampleHistory() : _claimed(0), _count(0) {}
+
+  static constexpr size_t capacity() { return N; }
+
+  // Only ever call from one task at a time
+  void add(const T& S) {
+    uint32_t seq = _count.load(std::memory_order_relaxed);
+    _claimed.store(seq + 1, std::memory_order_relaxed);   // tells readers this slot is about to change
+    std::atomic_thread_fence(std::memory_order_release);
+    _data[seq % N] = S;
+    _count.store(seq + 1, std::memory_order_release);
+  }
+
+  // Sequence number the next sample will get, i.e. how many samples have ever been added
+  uint32_t count() const { return _count.load(std::memory_order_acquire); }
+
+  // Sequence number of the oldest sample still held
+  uint32_t first() const {
+    uint32_t c = count();
+    return c > N ? c - N : 0;
+  }
+
+  size_t size() const {
+    uint32_t c = count();
+    return c > N ? N : c;
+  }
+
+  // Copies sample seq into out. Returns false if it has not been added yet or has already been overwritten.
+  bool read(uint32_t seq, T& out) const {
+    if(seq >= count()) {
+      return false;
+    }
+    out = _data[seq % N];
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return _claimed.load(std::memory_order_relaxed) - seq <= N;   // writer has not started on seq + N, which shares the slot
+  }
+
+  // Reads the history oldest first, skipping anything overwritten along the way. Anything added after the
+  // cursor was made is left out. since is accepted so code can treat this and CompressedHistory the same, it
+  // doesn't skip anything here.
+  class cursor {
+  public:
+    cursor(const SampleHistory& history, uint32_t /*since*/ = 0) : _h(&history), _seq(history.first()), _end(history.count()) {}
+
+    bool next(T& out) {
+      while(_seq < _end) {
+        if(_h->read(_seq++, out)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+  private:
+    const SampleHistory* _h;
+    uint32_t _seq;
+    uint32_t _end;
+  };
+
+private:
+  T _data[N];
+  std::atomic<uint32_t> _claimed;   // count + 1 while add() is writing, otherwise equal to _count
+  std::atomic<uint32_t> _count;
+};
+
+#endif
@@ -0,0 +1,50 @@
+/*
+    Single-writer sequence lock.
+
+    The writer never waits and readers never block it: a reader copies the value and retries if the writer
+    was part way through an update while it was copying. Used to hand state from the control task to the
+    web server task without either side taking a lock. T should be a small plain struct, it is copied whole
+    on every read and write.
+*/
+
+#ifndef SEQ_LOCK
+#define SEQ_LOCK
+
+#include <stdint.h>
+#include <atomic>
+
+template<typename T>
+class SeqLock {
+public:
+  SeqLock() : _seq(0), _data() {}
+
+  // Only ever call from one task at a time
+  void write(const T& value) {
+    uint32_t seq = _seq.load(std::memory_order_relaxed);
+    _seq.store(seq + 1, std::memory_order_relaxed);   // odd while the copy is in progress
+    std::atomic_thread_fence(std::memory_order_release);
+    _data = value;
+    _seq.store(seq + 2, std::memory_order_release);
+  }
+
+  T read() const {
+    T copy;
+    uint32_t before, after;
+    do {
+      before = _seq.load(std::memory_order_acquire);
+      copy = _data;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = _seq.load(std::memory_order_relaxed);
+    } while((before & 1) || before != after);
+    return copy;
+  }
+
+  // Number of completed writes, handy for telling readers whether anything changed since they last looked
+  uint32_t version() const { return _seq.load(std::memory_order_acquire) / 2; }
+
+private:
+  std::atomic<uint32_t> _seq;
+  T _data;
+};
+
+#endif
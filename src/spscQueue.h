@@ -0,0 +1,62 @@
+/*
+    Bounded single-producer/single-consumer queue.
+
+    One task pushes, one other task pops, neither ever blocks or takes a lock. Used to pass commands from the
+    web server task to the control task and acknowledgements back. Holds N - 1 items, one slot is kept empty
+    to tell a full queue from an empty one.
+*/
+
+#ifndef SPSC_QUEUE
+#define SPSC_QUEUE
+
+#include <stddef.h>
+#include <atomic>
+
+template<typename T, size_t N>
+class SpscQueue {
+  static_assert(N > 1, "SpscQueue needs at least two slots");
+
+public:
+  SpscQueue() : _head(0), _tail(0) {}
+
+  // Producer side. Returns false if the queue is full, the caller decides what back-pressure means.
+  bool push(const T& item) {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    size_t next = (tail + 1) % N;
+    if(next == _head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    _data[tail] = item;
+    _tail.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns a pointer to the oldest item without removing it, or NULL if the queue is empty.
+  const T* peek() const {
+    size_t head = _head.load(std::memory_order_relaxed);
+    if(head == _tail.load(std::memory_order_acquire)) {
+      return NULL;
+    }
+    return &_data[head];
+  }
+
+  // Consumer side. Returns false if the queue is empty.
+  bool pop(T& item) {
+    size_t head = _head.load(std::memory_order_relaxed);
+    if(head == _tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = _data[head];
+    _head.store((head + 1) % N, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const { return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire); }
+
+private:
+  T _data[N];
+  std::atomic<size_t> _head;    // next slot to pop, only written by the consumer
+  std::atomic<size_t> _tail;    // next slot to push, only written by the producer
+};
+
+#endif
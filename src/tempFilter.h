@@ -0,0 +1,196 @@
+/*
+    Cleans up DS18B20 readings before anything acts on them.
+
+    A disconnected probe reads -127 and a probe that has just been powered (or browned out) reads exactly 85
+    before its first conversion, and both used to go straight into the heat cut off and the history. Every
+    raw reading now goes through check() first, which catches:
+    - the sentinel values and anything the DS18B20 can't report at all
+    - a jump faster than maxSlew degrees per second, which water in a kettle can't do
+    - a reading that does not move at all for stuckUs while the heat is on, which real water does not do either
+    A bad reading is flagged straight away and never reaches the filter, so the caller can fail safe on the
+    same sample. Good readings go through a median of Median (knocks out single sample spikes) and then a
+    scalar Kalman filter (smooths the quantization steps of the low resolution modes). Both are a fixed amount
+    of work per reading.
+
+    No Arduino dependencies, so it can be run against recorded traces on a PC.
+*/
+
+#ifndef TEMP_FILTER
+#define TEMP_FILTER
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+enum tempFaults {
+  TEMP_OK,
+  TEMP_FAULT_DISCONNECTED,  // -127, the probe did not answer or the CRC failed
+  TEMP_FAULT_POWER_ON,      // 85 with nothing before it to say the water really is that hot
+  TEMP_FAULT_RANGE,         // outside what a DS18B20 can measure
+  TEMP_FAULT_SLEW,          // moved faster than water can
+  TEMP_FAULT_STUCK          // has not moved at all for too long while heating
+};
+
+inline const char* tempFaultName(tempFaults fault) {
+  static const char* names[] = {"none", "disconnected", "poweron", "range", "slew", "stuck"};
+  return names[fault];
+}
+
+template<size_t Median>
+class TempFilter {
+  static_assert(Median % 2 == 1, "TempFilter needs an odd median length");
+
+public:
+  // maxSlew in degrees C per second, stuckUs in microseconds, q and r are the Kalman process and measurement noise.
+  // The defaults settle at a gain of about 0.6, so a kettle heating at 0.5 degrees a second reads about 0.3 behind.
+  TempFilter(float maxSlew = 5.0f, int64_t stuckUs = 120000000, float q = 0.1f, float r = 0.1f) : _maxSlew(maxSlew), _stuckUs(stuckUs), _q(q), _r(r) {
+    reset();
+  }
+
+  // Forgets everything, the next reading is taken as it is
+  void reset() {
+    _count = 0;
+    _next = 0;
+    _haveLast = false;
+    _fault = TEMP_OK;
+    _goodRun = 0;
+    _wasHeating = false;
+  }
+
+  // Takes one raw reading taken at atUs (any microsecond clock) and returns the fault it shows, TEMP_OK if
+  // none. heating says whether a reading that does not change is suspicious.
+  tempFaults add(float rawC, int64_t atUs, bool heating) {
+    if(heating && !_wasHeating) {
+      _changedAt = atUs;    // water sitting still before the heat came on is fine, only time it from here
+    }
+    _wasHeating = heating;
+    _fault = check(rawC, atUs, heating);
+    if(_fault != TEMP_OK) {
+      _goodRun = 0;
+      return _fault;
+    }
+    if(!_haveLast || rawC != _lastRaw) {
+      _changedAt = atUs;
+    }
+    _haveLast = true;
+    _lastRaw = rawC;
+    _lastAt = atUs;
+    if(_goodRun < 255) {
+      _goodRun++;
+    }
+
+    _window[_next] = rawC;
+    _next = (_next + 1) % Median;
+    if(_count < Median) {
+      _count++;
+    }
+    float m = median();
+    if(_count == 1) {
+      _x = m;
+      _p = _r;
+    } else {
+      _p += _q;
+      float k = _p / (_p + _r);
+      _x += k * (m - _x);
+      _p *= 1 - k;
+    }
+    return TEMP_OK;
+  }
+
+  float value() const { return _x; }              // filtered temperature, only meaningful once a good reading has been added
+  bool ready() const { return _count > 0; }
+  tempFaults fault() const { return _fault; }     // of the last reading
+  uint8_t goodRun() const { return _goodRun; }    // good readings in a row since the last fault
+
+  // Writes everything add() depends on (not the settings from the constructor) for the control trace,
+  // load() puts it back. Out and In are controlTrace.h's tracePacker and traceUnpacker.
+  template<typename Out>
+  void save(Out& o) const {
+    for(size_t i = 0; i < Median; i++) {
+      o.f32(_window[i]);
+    }
+    o.u8(_count);
+    o.u8(_next);
+    o.u8(_haveLast | _wasHeating << 1);
+    o.f32(_lastRaw);
+    o.u64(_lastAt);
+    o.u64(_changedAt);
+    o.f32(_x);
+    o.f32(_p);
+    o.u8(_fault);
+    o.u8(_goodRun);
+  }
+
+  template<typename In>
+  void load(In& in) {
+    for(size_t i = 0; i < Median; i++) {
+      _window[i] = in.f32();
+    }
+    _count = in.u8() % (Median + 1);
+    _next = in.u8() % Median;
+    uint8_t flags = in.u8();
+    _haveLast = flags & 1;
+    _wasHeating = flags & 2;
+    _lastRaw = in.f32();
+    _lastAt = in.u64();
+    _changedAt = in.u64();
+    _x = in.f32();
+    _p = in.f32();
+    _fault = (tempFaults)in.u8();
+    _goodRun = in.u8();
+  }
+
+private:
+  tempFaults check(float rawC, int64_t atUs, bool heating) const {
+    if(rawC <= -127.0f) {
+      return TEMP_FAULT_DISCONNECTED;
+    }
+    if(rawC < -55.0f || rawC > 125.0f) {
+      return TEMP_FAULT_RANGE;
+    }
+    if(!_haveLast) {
+      return rawC == 85.0f ? TEMP_FAULT_POWER_ON : TEMP_OK;   // can't tell a real 85 from the reset value without history
+    }
+    float dt = (atUs - _lastAt) / 1e6f;
+    if(fabsf(rawC - _lastRaw) > _maxSlew * dt + 0.5f) {    // + one 9 bit step so quantization alone never trips it
+      return rawC == 85.0f ? TEMP_FAULT_POWER_ON : TEMP_FAULT_SLEW;
+    }
+    if(heating && rawC == _lastRaw && atUs - _changedAt >= _stuckUs) {
+      return TEMP_FAULT_STUCK;
+    }
+    return TEMP_OK;
+  }
+
+  float median() const {    // of the readings in the window, insertion sort of a copy is cheapest at this size
+    float v[Median];
+    for(size_t i = 0; i < _count; i++) {
+      float x = _window[i];
+      size_t j = i;
+      while(j > 0 && v[j - 1] > x) {
+        v[j] = v[j - 1];
+        j--;
+      }
+      v[j] = x;
+    }
+    return v[_count / 2];
+  }
+
+  float _maxSlew;
+  int64_t _stuckUs;
+  float _q;
+  float _r;
+  float _window[Median];
+  size_t _count;      // readings in _window
+  size_t _next;       // where the next one goes
+  bool _haveLast;
+  float _lastRaw;     // last good raw reading
+  int64_t _lastAt;
+  int64_t _changedAt; // when the raw reading last changed, or the heat came on
+  bool _wasHeating;
+  float _x;           // Kalman estimate
+  float _p;           // and its variance
+  tempFaults _fault;
+  uint8_t _goodRun;
+};
+
+#endif
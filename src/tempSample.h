@@ -0,0 +1,87 @@
+/*
+    Compact temperature history sample.
+
+    The history used to keep a String time label (formatted with strftime on every read) next to a float,
+    which cost 30+ bytes of heap per entry. A sample is now 6 bytes with no heap at all: the epoch second it
+    was taken and the reading in hundredths of a degree. Labels are only formatted when the history is
+    serialized.
+*/
+
+#ifndef TEMP_SAMPLE
+#define TEMP_SAMPLE
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+struct tempSample {
+  uint32_t epoch;   // seconds since 1970 UTC, as returned by time()
+  int16_t centiC;   // temperature in hundredths of a degree C (-327.68 to 327.67, plenty for a kettle and the -127 sensor error value)
+} __attribute__((packed));
+
+inline int16_t toCentiC(float tempC) {
+  float scaled = tempC * 100.0f;
+  if(scaled > 32767.0f) return 32767;
+  if(scaled < -32768.0f) return -32768;
+  return (int16_t)(scaled < 0 ? scaled - 0.5f : scaled + 0.5f);   // round to nearest rather than truncate
+}
+
+inline float fromCentiC(int16_t centiC) {
+  return centiC / 100.0f;
+}
+
+inline tempSample makeSample(time_t epoch, float tempC) {
+  tempSample S;
+  S.epoch = (uint32_t)epoch;
+  S.centiC = toCentiC(tempC);
+  return S;
+}
+
+// Writes centi-degrees as a decimal number with two places, without going through a float
+inline int formatCentiC(char* buf, size_t len, int16_t centiC) {
+  int value = centiC;
+  const char* sign = "";
+  if(value < 0) {
+    sign = "-";
+    value = -value;
+  }
+  return snprintf(buf, len, "%s%d.%02d", sign, value / 100, value % 100);
+}
+
+// Summary of every sample whose epoch falls in [start, start + bucket width), used by the rolled up history tiers
+struct tempBucket {
+  uint32_t start;   // epoch second the bucket starts at, always a multiple of the tier's bucket width
+  int16_t minC;     // all in centi-degrees like tempSample
+  int16_t maxC;
+  int16_t meanC;
+  uint16_t count;   // number of samples that went into it
+} __attribute__((packed));
+
+// Lets code that serves buckets treat a raw sample as a bucket of one
+inline tempBucket toBucket(const tempSample& S) {
+  tempBucket B = {S.epoch, S.centiC, S.centiC, S.centiC, 1};
+  return B;
+}
+
+inline tempBucket toBucket(const tempBucket& B) {
+  return B;
+}
+
+// Writes the local HH:MM:SS of the sample into buf (needs 9 bytes). Matches the old justTime() output,
+// including "Error" if NTP had not synced yet when the sample was taken.
+inline const char* sampleTimeLabel(const tempSample& S, char* buf, size_t len) {
+  time_t t = S.epoch;
+  struct tm timeinfo;
+  localtime_r(&t, &timeinfo);
+  if(timeinfo.tm_year < (2016 - 1900)) {   // same sanity check getLocalTime() uses
+    strncpy(buf, "Error", len);
+    buf[len - 1] = 0;
+    return buf;
+  }
+  strftime(buf, len, "%H:%M:%S", &timeinfo);
+  return buf;
+}
+
+#endif
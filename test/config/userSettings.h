@@ -0,0 +1,3 @@
+// The tests are written against the sample settings, whatever src/config/userSettings.h says. Every test
+// includes config/userSettingsSAMPLE.h first, this only stands in for userSettings.h on a fresh checkout.
+#include "config/userSettingsSAMPLE.h"
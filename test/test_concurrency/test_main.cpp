@@ -0,0 +1,182 @@
+/*
+    SeqLock, SampleHistory and CompressedHistory with one writer thread and several reader threads going flat
+    out, the way the control task and the web server use them. Every value written carries a check on itself,
+    so a reader that gets half of one write and half of another, or a sample that was never written, fails.
+    pio test -e native -f test_concurrency
+*/
+
+#include <stdint.h>
+#include "config/userSettingsSAMPLE.h"
+
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "seqLock.h"
+#include "sampleHistory.h"
+#include "compressedHistory.h"
+
+const int readers = 3;
+const uint32_t writes = 200000;
+
+void setUp() {}
+void tearDown() {}
+
+struct stressState {
+  uint32_t a;
+  uint32_t b;
+  uint32_t c[6];
+  uint32_t sum;
+};
+
+stressState makeState(uint32_t i) {
+  stressState S;
+  S.a = i;
+  S.b = ~i;
+  S.sum = S.a + S.b;
+  for(int j = 0; j < 6; j++) {
+    S.c[j] = i * (j + 3);
+    S.sum += S.c[j];
+  }
+  return S;
+}
+
+bool consistent(const stressState& S) {
+  return S.b == ~S.a && S.sum == makeState(S.a).sum && S.c[5] == S.a * 8;
+}
+
+// Sample i of the stress runs. The reading is worked out from the epoch so a reader can check it.
+tempSample stressSample(uint32_t i) {
+  tempSample S;
+  S.epoch = 1690000000 + i * 15 + (i % 7 == 0 ? 3 : 0);   // the odd late one so the archive isn't all 2 bit samples
+  S.centiC = (int16_t)(2000 + (S.epoch * 37) % 3000);
+  return S;
+}
+
+bool sampleOk(const tempSample& S) {
+  return S.epoch >= 1690000000 && S.centiC == (int16_t)(2000 + (S.epoch * 37) % 3000);
+}
+
+void testSeqLockReadersNeverSeeATornWrite() {
+  SeqLock<stressState> L;
+  L.write(makeState(0));
+  std::atomic<bool> done(false);
+  std::atomic<uint32_t> bad(0);
+  std::atomic<uint32_t> backwards(0);
+  std::vector<std::thread> threads;
+  for(int r = 0; r < readers; r++) {
+    threads.push_back(std::thread([&]() {
+      uint32_t last = 0;
+      while(!done.load()) {
+        stressState S = L.read();
+        if(!consistent(S)) {
+          bad++;
+        }
+        if(S.a < last) {
+          backwards++;
+        }
+        last = S.a;
+      }
+    }));
+  }
+  for(uint32_t i = 1; i <= writes; i++) {
+    L.write(makeState(i));
+  }
+  done = true;
+  for(size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+  TEST_ASSERT_EQUAL(0, bad.load());
+  TEST_ASSERT_EQUAL(0, backwards.load());
+  TEST_ASSERT_EQUAL(writes + 1, L.version());
+}
+
+void testSampleHistoryReadersGetWholeSamplesOrNothing() {
+  static SampleHistory<64> H;
+  std::atomic<bool> done(false);
+  std::atomic<uint32_t> bad(0);
+  std::atomic<uint32_t> reads(0);
+  std::vector<std::thread> threads;
+  for(int r = 0; r < readers; r++) {
+    threads.push_back(std::thread([&]() {
+      while(!done.load()) {
+        uint32_t n = 0;
+        uint32_t c = H.count();
+        for(uint32_t seq = c > 80 ? c - 80 : 0; seq < c; seq++) {   // some of these are gone already
+          tempSample S;
+          if(H.read(seq, S)) {
+            n++;
+            if(S.epoch != stressSample(seq).epoch || !sampleOk(S)) {
+              bad++;
+            }
+          }
+        }
+        SampleHistory<64>::cursor C(H);
+        tempSample S;
+        uint32_t lastEpoch = 0;
+        while(C.next(S)) {
+          n++;
+          if(!sampleOk(S) || S.epoch <= lastEpoch) {
+            bad++;
+          }
+          lastEpoch = S.epoch;
+        }
+        reads += n;
+      }
+    }));
+  }
+  for(uint32_t i = 0; i < writes; i++) {
+    H.add(stressSample(i));
+  }
+  done = true;
+  for(size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+  TEST_ASSERT_EQUAL(0, bad.load());
+  TEST_ASSERT_TRUE(reads.load() > 0);
+  TEST_ASSERT_EQUAL(writes, H.count());
+}
+
+void testCompressedHistoryReadersSurviveBlockReuse() {
+  static CompressedHistory<32, 4> H;    // small so blocks get reused under the readers all the time
+  std::atomic<bool> done(false);
+  std::atomic<uint32_t> bad(0);
+  std::atomic<uint32_t> reads(0);
+  std::vector<std::thread> threads;
+  for(int r = 0; r < readers; r++) {
+    threads.push_back(std::thread([&]() {
+      while(!done.load()) {
+        CompressedHistory<32, 4>::cursor C(H);
+        tempSample S;
+        uint32_t lastEpoch = 0;
+        uint32_t n = 0;
+        while(C.next(S)) {
+          n++;
+          if(!sampleOk(S) || S.epoch <= lastEpoch) {
+            bad++;
+          }
+          lastEpoch = S.epoch;
+        }
+        reads += n;
+      }
+    }));
+  }
+  for(uint32_t i = 0; i < writes; i++) {
+    H.add(stressSample(i));
+  }
+  done = true;
+  for(size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+  TEST_ASSERT_EQUAL(0, bad.load());
+  TEST_ASSERT_TRUE(reads.load() > 0);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testSeqLockReadersNeverSeeATornWrite);
+  RUN_TEST(testSampleHistoryReadersGetWholeSamplesOrNothing);
+  RUN_TEST(testCompressedHistoryReadersSurviveBlockReuse);
+  return UNITY_END();
+}
@@ -0,0 +1,161 @@
+/*
+    The control logic from kettleControl.h on the native HAL: commands in, relay, arm and history out, on the
+    simulated clock. The tests share the control logic's globals and run in order from one boot, each picking
+    up the kettle where the last one left it. pio test -e native -f test_control
+*/
+
+#include <stdint.h>
+#include "config/userSettingsSAMPLE.h"
+
+#include <unity.h>
+#include <string.h>
+
+#include "kettleControl.h"
+
+const int64_t stepUs = CONTROL_PERIOD_MS * 1000LL;
+
+void setUp() {}
+void tearDown() {}
+
+void runFor(int64_t us) {
+  for(int64_t end = nativeHw.nowUs + us; nativeHw.nowUs < end;) {
+    nativeHw.nowUs += stepUs;
+    controlStep();
+  }
+}
+
+void setProbes(float c) {
+  for(int i = 0; i < 8; i++) {
+    nativeHw.probeC[i] = c;
+  }
+}
+
+// Runs the command in the next control step and returns its ack
+commandAck command(kettleCommandType type) {
+  TEST_ASSERT_TRUE(queueCommand(type) != 0);
+  runFor(stepUs);
+  commandAck A;
+  TEST_ASSERT_TRUE(ackQueue.pop(A));
+  TEST_ASSERT_EQUAL(type, A.type);
+  return A;
+}
+
+void testBootPressesTheKettleOff() {
+  TEST_ASSERT_EQUAL(MAX_PROBES, probeCount);
+  TEST_ASSERT_FALSE(nativeHw.pump);
+  runFor(stepUs);
+  TEST_ASSERT_EQUAL(KETTLE_OFF, nativeHw.armAngle);
+  runFor(KETTLE_PRESS_MS * 1000LL);
+  TEST_ASSERT_EQUAL(KETTLE_NEUTRAL, nativeHw.armAngle);
+  TEST_ASSERT_TRUE(armQueue.empty());
+}
+
+void testReadingsAreFilteredAndStored() {
+  setProbes(21.5f);
+  runFor(TEMP_READ_FREQ * 1000LL);
+  TEST_ASSERT_EQUAL(TEMP_OK, tempFault);
+  TEST_ASSERT_TRUE(tempTrusted());
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 21.5f, tempReading);
+  for(int i = 0; i < MAX_PROBES; i++) {
+    tempSample S;
+    TEST_ASSERT_EQUAL(1, probeHistory[i].count());
+    TEST_ASSERT_TRUE(probeHistory[i].read(0, S));
+    TEST_ASSERT_EQUAL(2150, S.centiC);
+    TEST_ASSERT_EQUAL(halEpoch(), S.epoch);
+  }
+  TEST_ASSERT_EQUAL(halEpoch(), archiveHistory.oldestEpoch());   // archived as well
+
+  char buf[statusJSONBytes];
+  TEST_ASSERT_TRUE(statusJSON(buf, sizeof(buf)) > 0);
+  TEST_ASSERT_NOT_NULL(strstr(buf, "\"pump\":false,\"heat\":false,\"kettle\":false"));
+  TEST_ASSERT_NOT_NULL(strstr(buf, "\"tempreading\":21.50"));
+}
+
+void testPumpCommandsSwitchTheRelay() {
+  uint32_t id = queueCommand(CMD_PUMP_ON);
+  TEST_ASSERT_FALSE(commandPublished(id));      // the web server waits on this to answer with the new status
+  runFor(stepUs);
+  TEST_ASSERT_TRUE(commandPublished(id));
+  TEST_ASSERT_TRUE(publishedState.read().pump);
+  commandAck A;
+  TEST_ASSERT_TRUE(ackQueue.pop(A));
+  TEST_ASSERT_EQUAL(id, A.id);
+  TEST_ASSERT_TRUE(A.ok);
+  TEST_ASSERT_TRUE(nativeHw.pump);
+
+  // A double click cancels out without touching the relay
+  queueCommand(CMD_PUMP_TOGGLE);
+  queueCommand(CMD_PUMP_TOGGLE);
+  runFor(stepUs);
+  for(int i = 0; i < 2; i++) {
+    TEST_ASSERT_TRUE(ackQueue.pop(A));
+    TEST_ASSERT_TRUE(A.coalesced);
+  }
+  TEST_ASSERT_TRUE(nativeHw.pump);
+
+  A = command(CMD_PUMP_TOGGLE);
+  TEST_ASSERT_TRUE(A.ok);
+  TEST_ASSERT_FALSE(A.coalesced);
+  TEST_ASSERT_FALSE(nativeHw.pump);
+  TEST_ASSERT_FALSE(publishedState.read().pump);
+}
+
+void testFullKettleRefusesThePumpAndAllowsHeat() {
+  TEST_ASSERT_FALSE(command(CMD_HEAT_ON).ok);   // empty
+  TEST_ASSERT_TRUE(command(CMD_PUMP_ON).ok);
+  nativeSetFloat(HIGH);
+  TEST_ASSERT_FALSE(nativeHw.pump);             // cut straight away, not at the next step
+  runFor(debounceDelayUs + stepUs);
+  TEST_ASSERT_TRUE(kettleFull);
+  TEST_ASSERT_EQUAL(LOW, pumpStatus);
+  TEST_ASSERT_FALSE(command(CMD_PUMP_ON).ok);
+  TEST_ASSERT_FALSE(nativeHw.pump);
+
+  TEST_ASSERT_TRUE(command(CMD_HEAT_ON).ok);
+  TEST_ASSERT_EQUAL(HIGH, heatStatus);
+  TEST_ASSERT_EQUAL(KETTLE_ON, nativeHw.armAngle);
+}
+
+void testHeatGoesOffAtTargetTemp() {
+  float c = 21.5f;
+  while(heatStatus == HIGH && c < targetTemp + 5) {
+    c += 1.0f * CONTROL_PERIOD_MS / 1000;   // a degree a second, well inside TEMP_MAX_SLEW
+    setProbes(c);
+    runFor(stepUs);
+  }
+  TEST_ASSERT_EQUAL(LOW, heatStatus);
+  TEST_ASSERT_TRUE(tempReading >= targetTemp - 0.5f);
+  TEST_ASSERT_TRUE(c < targetTemp + 2);         // the filter's lag, not a missed cut off
+  TEST_ASSERT_FALSE(armQueue.empty());
+  TEST_ASSERT_EQUAL(KETTLE_OFF, armQueue.front().angle);
+  runFor(stepUs);
+  TEST_ASSERT_EQUAL(KETTLE_OFF, nativeHw.armAngle);
+}
+
+void testPumpTimesOutWithoutTheFloat() {
+  nativeSetFloat(LOW);
+  runFor(debounceDelayUs + stepUs);
+  TEST_ASSERT_FALSE(kettleFull);
+  TEST_ASSERT_TRUE(command(CMD_PUMP_ON).ok);
+  runFor(timeoutPump * 1000LL - 2 * stepUs);
+  TEST_ASSERT_TRUE(nativeHw.pump);
+  runFor(2 * stepUs);
+  TEST_ASSERT_FALSE(nativeHw.pump);
+  TEST_ASSERT_EQUAL(LOW, pumpStatus);
+}
+
+int main() {
+  nativeHw.quiet = true;
+  nativeHw.probes = MAX_PROBES;
+  halFloatBegin();
+  controlBegin();
+
+  UNITY_BEGIN();
+  RUN_TEST(testBootPressesTheKettleOff);
+  RUN_TEST(testReadingsAreFilteredAndStored);
+  RUN_TEST(testPumpCommandsSwitchTheRelay);
+  RUN_TEST(testFullKettleRefusesThePumpAndAllowsHeat);
+  RUN_TEST(testHeatGoesOffAtTargetTemp);
+  RUN_TEST(testPumpTimesOutWithoutTheFloat);
+  return UNITY_END();
+}
@@ -0,0 +1,89 @@
+/*
+    The float switch cutting the pump mid-fill: the relay goes off at the edge itself, not at the next control
+    step, and nothing in the control logic switches it back on afterwards, bounces included.
+    pio test -e native -f test_floatSwitch
+*/
+
+#include <stdint.h>
+#include "config/userSettingsSAMPLE.h"
+
+#include <unity.h>
+
+#include "kettleControl.h"
+
+const int64_t stepUs = CONTROL_PERIOD_MS * 1000LL;
+
+int pumpWrites = 0;   // halPump(true) calls
+int offWrites = 0;    // halPump(false) calls
+
+void countOutputs(bool arm, int value) {
+  if(!arm) {
+    (value ? pumpWrites : offWrites)++;
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void runFor(int64_t us) {
+  for(int64_t end = nativeHw.nowUs + us; nativeHw.nowUs < end;) {
+    nativeHw.nowUs += stepUs;
+    controlStep();
+  }
+}
+
+void testFloatCutsThePumpMidFill() {
+  TEST_ASSERT_TRUE(queueCommand(CMD_PUMP_ON) != 0);
+  runFor(2 * stepUs);
+  TEST_ASSERT_TRUE(nativeHw.pump);
+  TEST_ASSERT_EQUAL(HIGH, pumpStatus);
+  TEST_ASSERT_EQUAL(1, pumpWrites);
+
+  // Halfway between two steps, like the float coming up while the control task sleeps
+  nativeHw.nowUs += stepUs / 2;
+  nativeSetFloat(HIGH);
+  TEST_ASSERT_FALSE(nativeHw.pump);           // cut at the edge, before any control step runs
+  TEST_ASSERT_EQUAL(1, nativeHw.floatCuts);
+  TEST_ASSERT_EQUAL(0, offWrites);            // by the "interrupt", not through halPump()
+
+  nativeHw.nowUs += stepUs / 2;
+  controlStep();                              // the step that sees the edge catches up with it
+  TEST_ASSERT_FALSE(nativeHw.pump);
+  TEST_ASSERT_EQUAL(LOW, pumpStatus);
+  TEST_ASSERT_FALSE(kettleFull);              // not settled yet, the cut doesn't wait for the debounce
+  TEST_ASSERT_FALSE(publishedState.read().pump);
+}
+
+void testPumpStaysOffThroughBouncesAndAfter() {
+  // The float chatters at the top before it settles
+  for(int i = 0; i < 4; i++) {
+    nativeHw.nowUs += stepUs / 4;
+    nativeSetFloat(i % 2 ? HIGH : LOW);
+    nativeHw.nowUs += stepUs / 4;
+    controlStep();
+    TEST_ASSERT_FALSE(nativeHw.pump);
+  }
+  TEST_ASSERT_EQUAL(HIGH, nativeHw.floatLevel);
+  runFor(debounceDelayUs + stepUs);
+  TEST_ASSERT_TRUE(kettleFull);
+  runFor(timeoutPump * 1000LL);               // past the pump's own timeout too
+  TEST_ASSERT_FALSE(nativeHw.pump);
+  TEST_ASSERT_EQUAL(LOW, pumpStatus);
+  TEST_ASSERT_EQUAL(1, pumpWrites);           // never switched back on
+  TEST_ASSERT_EQUAL(1, nativeHw.floatCuts);   // the pump was already off for the later edges
+}
+
+int main() {
+  nativeHw.quiet = true;
+  nativeHw.probes = MAX_PROBES;
+  halFloatBegin();
+  controlBegin();
+  nativeOnOutput = countOutputs;
+  nativeHw.nowUs += KETTLE_PRESS_MS * 1000LL;
+  controlStep();
+
+  UNITY_BEGIN();
+  RUN_TEST(testFloatCutsThePumpMidFill);
+  RUN_TEST(testPumpStaysOffThroughBouncesAndAfter);
+  return UNITY_END();
+}
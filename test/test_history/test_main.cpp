@@ -0,0 +1,211 @@
+/*
+    RingBuffer, SampleHistory and CompressedHistory on their own: what is kept once they wrap around, in what
+    order it comes back, and that nothing is returned that was never added. pio test -e native -f test_history
+*/
+
+#include <stdint.h>
+#include "config/userSettingsSAMPLE.h"
+
+#include <unity.h>
+#include <vector>
+
+#include "ringBuffer.h"
+#include "sampleHistory.h"
+#include "compressedHistory.h"
+
+void setUp() {}
+void tearDown() {}
+
+void testRingBufferFillsThenEvictsOldest() {
+  RingBuffer<int, 4> R;
+  TEST_ASSERT_TRUE(R.empty());
+  for(int i = 0; i < 4; i++) {
+    TEST_ASSERT_FALSE(R.push(i));
+  }
+  TEST_ASSERT_TRUE(R.full());
+  TEST_ASSERT_TRUE(R.push(4));    // evicts 0
+  TEST_ASSERT_EQUAL(4, R.size());
+  TEST_ASSERT_EQUAL(1, R.front());
+  TEST_ASSERT_EQUAL(4, R.back());
+}
+
+void testRingBufferWrapsManyTimes() {
+  RingBuffer<int, 5> R;
+  for(int i = 0; i < 1003; i++) {
+    R.push(i);
+  }
+  TEST_ASSERT_EQUAL(5, R.size());
+  int expected = 998;
+  for(RingBuffer<int, 5>::const_iterator it = R.begin(); it != R.end(); ++it) {
+    TEST_ASSERT_EQUAL(expected++, *it);
+  }
+  TEST_ASSERT_EQUAL(1003, expected);
+}
+
+void testRingBufferPopAndClear() {
+  RingBuffer<int, 3> R;
+  TEST_ASSERT_FALSE(R.pop());
+  R.push(1);
+  R.push(2);
+  R.push(3);
+  R.push(4);
+  TEST_ASSERT_TRUE(R.pop());
+  TEST_ASSERT_EQUAL(3, R.front());
+  R.push(5);
+  R.push(6);    // wraps past the slot pop() freed
+  TEST_ASSERT_EQUAL(3, R.size());
+  TEST_ASSERT_EQUAL(4, R[0]);
+  TEST_ASSERT_EQUAL(5, R[1]);
+  TEST_ASSERT_EQUAL(6, R[2]);
+  R.clear();
+  TEST_ASSERT_TRUE(R.empty());
+  TEST_ASSERT_TRUE(R.begin() == R.end());
+}
+
+void testSampleHistoryBeforeWrapping() {
+  SampleHistory<8> H;
+  TEST_ASSERT_EQUAL(0, H.count());
+  TEST_ASSERT_EQUAL(0, H.first());
+  tempSample S;
+  TEST_ASSERT_FALSE(H.read(0, S));
+  for(uint32_t i = 0; i < 5; i++) {
+    H.add(makeSample(1690000000 + i * 15, 20 + i));
+  }
+  TEST_ASSERT_EQUAL(5, H.size());
+  TEST_ASSERT_TRUE(H.read(4, S));
+  TEST_ASSERT_EQUAL(1690000060, S.epoch);
+  TEST_ASSERT_EQUAL(2400, S.centiC);
+  TEST_ASSERT_FALSE(H.read(5, S));
+}
+
+void testSampleHistoryWrapsAndKeepsSequenceNumbers() {
+  SampleHistory<8> H;
+  for(uint32_t i = 0; i < 21; i++) {
+    H.add(makeSample(1690000000 + i, i));
+  }
+  TEST_ASSERT_EQUAL(21, H.count());
+  TEST_ASSERT_EQUAL(13, H.first());
+  TEST_ASSERT_EQUAL(8, H.size());
+  tempSample S;
+  TEST_ASSERT_FALSE(H.read(12, S));   // overwritten by 20, which shares its slot
+  TEST_ASSERT_TRUE(H.read(13, S));
+  TEST_ASSERT_EQUAL(1690000013, S.epoch);
+  TEST_ASSERT_TRUE(H.read(20, S));
+  TEST_ASSERT_EQUAL(2000, S.centiC);
+
+  SampleHistory<8>::cursor C(H);
+  uint32_t expected = 13;
+  while(C.next(S)) {
+    TEST_ASSERT_EQUAL(1690000000 + expected, S.epoch);
+    expected++;
+  }
+  TEST_ASSERT_EQUAL(21, expected);
+}
+
+void testSampleHistoryCursorLeavesOutLaterSamples() {
+  SampleHistory<4> H;
+  H.add(makeSample(1, 1));
+  H.add(makeSample(2, 2));
+  SampleHistory<4>::cursor C(H);
+  H.add(makeSample(3, 3));
+  tempSample S;
+  TEST_ASSERT_TRUE(C.next(S));
+  TEST_ASSERT_TRUE(C.next(S));
+  TEST_ASSERT_EQUAL(2, S.epoch);
+  TEST_ASSERT_FALSE(C.next(S));
+}
+
+// Readings on schedule with small changes, then late and early ones and big jumps so every gap and value
+// width gets written
+tempSample archiveSample(uint32_t i) {
+  static uint32_t epoch = 1690000000;
+  static int16_t c = 2000;
+  if(i == 0) {
+    epoch = 1690000000;
+    c = 2000;
+  }
+  uint32_t gaps[] = {15, 15, 15, 16, 14, 15, 200, 15, 5000, 15, 15, 100000};
+  int16_t steps[] = {0, 0, 3, -2, 0, 40, 0, -300, 0, 9000, -9000, 259};   // adds up to 0 so it never drifts out of range
+  epoch += gaps[i % 12];
+  c += steps[i % 12];
+  return makeSample(epoch, fromCentiC(c));
+}
+
+void testCompressedHistoryRoundTrip() {
+  CompressedHistory<32, 4> H;
+  std::vector<tempSample> added;
+  for(uint32_t i = 0; i < 30; i++) {
+    tempSample S = archiveSample(i);
+    H.add(S);
+    added.push_back(S);
+  }
+  CompressedHistory<32, 4>::cursor C(H);
+  tempSample S;
+  size_t i = 0;
+  while(C.next(S)) {
+    TEST_ASSERT_TRUE(i < added.size());
+    TEST_ASSERT_EQUAL(added[i].epoch, S.epoch);
+    TEST_ASSERT_EQUAL(added[i].centiC, S.centiC);
+    i++;
+  }
+  TEST_ASSERT_EQUAL(added.size(), i);
+  TEST_ASSERT_EQUAL(added[0].epoch, H.oldestEpoch());
+}
+
+void testCompressedHistoryWrapsToANewestSuffix() {
+  CompressedHistory<32, 4> H;
+  std::vector<tempSample> added;
+  for(uint32_t i = 0; i < 2000; i++) {
+    tempSample S = archiveSample(i);
+    H.add(S);
+    added.push_back(S);
+  }
+  // Whatever is still held has to be an unbroken run of the newest samples
+  CompressedHistory<32, 4>::cursor C(H);
+  std::vector<tempSample> held;
+  tempSample S;
+  while(C.next(S)) {
+    held.push_back(S);
+  }
+  TEST_ASSERT_TRUE(held.size() > 0);
+  TEST_ASSERT_TRUE(held.size() < added.size());
+  size_t offset = added.size() - held.size();
+  for(size_t i = 0; i < held.size(); i++) {
+    TEST_ASSERT_EQUAL(added[offset + i].epoch, held[i].epoch);
+    TEST_ASSERT_EQUAL(added[offset + i].centiC, held[i].centiC);
+  }
+  TEST_ASSERT_EQUAL(held[0].epoch, H.oldestEpoch());
+}
+
+void testCompressedHistorySinceSkipsWholeBlocks() {
+  CompressedHistory<32, 8> H;
+  for(uint32_t i = 0; i < 600; i++) {   // about 128 steady samples to a block
+    H.add(makeSample(1000 + i * 15, 20));
+  }
+  uint32_t since = 1000 + 500 * 15;
+  CompressedHistory<32, 8>::cursor C(H, since);
+  tempSample S;
+  TEST_ASSERT_TRUE(C.next(S));
+  TEST_ASSERT_TRUE(S.epoch <= since);   // the block holding since is decoded from its start
+  TEST_ASSERT_TRUE(S.epoch > 1000);     // but the ones before it are not
+  uint32_t last = S.epoch;
+  while(C.next(S)) {
+    TEST_ASSERT_EQUAL(last + 15, S.epoch);
+    last = S.epoch;
+  }
+  TEST_ASSERT_EQUAL(1000 + 599 * 15, last);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testRingBufferFillsThenEvictsOldest);
+  RUN_TEST(testRingBufferWrapsManyTimes);
+  RUN_TEST(testRingBufferPopAndClear);
+  RUN_TEST(testSampleHistoryBeforeWrapping);
+  RUN_TEST(testSampleHistoryWrapsAndKeepsSequenceNumbers);
+  RUN_TEST(testSampleHistoryCursorLeavesOutLaterSamples);
+  RUN_TEST(testCompressedHistoryRoundTrip);
+  RUN_TEST(testCompressedHistoryWrapsToANewestSuffix);
+  RUN_TEST(testCompressedHistorySinceSkipsWholeBlocks);
+  return UNITY_END();
+}
@@ -0,0 +1,170 @@
+/*
+    PhaseHistogram's buckets and percentiles, and the phase timing around it: PHASE_TIME on the simulated
+    clock and what /api/timing streams out. pio test -e native -f test_phaseTiming
+*/
+
+#include <stdint.h>
+#include "config/userSettingsSAMPLE.h"
+
+#include <unity.h>
+#include <string>
+
+#include "phaseTiming.h"
+
+void setUp() {
+  for(size_t i = 0; i < PHASE_COUNT; i++) {
+    phaseTimes[i].reset();
+  }
+  nativeHw.nowUs = 0;
+}
+
+void tearDown() {}
+
+void testBucketsCoverEveryValueOnce() {
+  TEST_ASSERT_EQUAL(0, PhaseHistogram::bucketOf(0));
+  TEST_ASSERT_EQUAL(1, PhaseHistogram::bucketOf(1));
+  TEST_ASSERT_EQUAL(2, PhaseHistogram::bucketOf(2));
+  TEST_ASSERT_EQUAL(3, PhaseHistogram::bucketOf(3));
+  TEST_ASSERT_EQUAL(4, PhaseHistogram::bucketOf(4));
+  TEST_ASSERT_EQUAL(4, PhaseHistogram::bucketOf(5));
+  TEST_ASSERT_EQUAL(5, PhaseHistogram::bucketOf(6));
+  TEST_ASSERT_EQUAL(5, PhaseHistogram::bucketOf(7));
+  // Every bucket starts where the last one ended, and holds everything up to where the next one starts
+  for(size_t b = 0; b + 1 < PhaseHistogram::BUCKETS; b++) {
+    uint32_t low = PhaseHistogram::bucketLow(b);
+    uint32_t next = PhaseHistogram::bucketLow(b + 1);
+    TEST_ASSERT_TRUE(next > low);
+    TEST_ASSERT_EQUAL(b, PhaseHistogram::bucketOf(low));
+    TEST_ASSERT_EQUAL(b, PhaseHistogram::bucketOf(next - 1));
+    if(b >= 2) {
+      TEST_ASSERT_TRUE(next - low <= low / 2);    // two per power of two, so the top of a bucket is at most 50% over its bottom
+    }
+  }
+  TEST_ASSERT_EQUAL(12582912, PhaseHistogram::bucketLow(PhaseHistogram::BUCKETS - 1));   // 3 << 22, about 12.6s
+  TEST_ASSERT_EQUAL(PhaseHistogram::BUCKETS - 1, PhaseHistogram::bucketOf(UINT32_MAX));
+}
+
+void testEmptyHistogram() {
+  PhaseHistogram H;
+  TEST_ASSERT_EQUAL(0, H.count());
+  TEST_ASSERT_EQUAL(0, H.minUs());
+  TEST_ASSERT_EQUAL(0, H.maxUs());
+  TEST_ASSERT_EQUAL(0, H.percentileUs(0.5f));
+}
+
+void testMinMaxAndOverruns() {
+  PhaseHistogram H;
+  H.add(40, 100);
+  H.add(7, 100);
+  H.add(100, 100);    // on the budget is not over it
+  H.add(250, 100);
+  TEST_ASSERT_EQUAL(4, H.count());
+  TEST_ASSERT_EQUAL(7, H.minUs());
+  TEST_ASSERT_EQUAL(250, H.maxUs());
+  TEST_ASSERT_EQUAL(1, H.overruns());
+  H.reset();
+  TEST_ASSERT_EQUAL(0, H.count());
+  TEST_ASSERT_EQUAL(0, H.overruns());
+}
+
+void testPercentilesOfAUniformSpread() {
+  PhaseHistogram H;
+  for(uint32_t us = 1; us <= 1000; us++) {
+    H.add(us, 10000);
+  }
+  // The top of the bucket the rank falls in, so never under the true value and at most a bucket over
+  uint32_t p50 = H.percentileUs(0.5f);
+  uint32_t p99 = H.percentileUs(0.99f);
+  TEST_ASSERT_TRUE(p50 >= 500 && p50 <= 500 * 1.25f);
+  TEST_ASSERT_TRUE(p99 >= 990 && p99 <= 1000);    // kept under the max
+  TEST_ASSERT_EQUAL(1, H.percentileUs(0.0f));
+  TEST_ASSERT_EQUAL(1000, H.percentileUs(1.0f));
+}
+
+void testPercentilesAreNeverLowAndAtMostHalfHigh() {
+  for(uint32_t us = 2; us < 5000000; us += 1 + us / 7) {
+    PhaseHistogram H;
+    H.add(us, 0);
+    H.add(us, 0);
+    H.add(10000000, 0);   // so max doesn't clamp the answer
+    uint32_t p50 = H.percentileUs(0.5f);
+    TEST_ASSERT_TRUE(p50 >= us);
+    TEST_ASSERT_TRUE(p50 < us + us / 2);
+  }
+}
+
+void testPercentilesOfALongTail() {
+  PhaseHistogram H;
+  for(int i = 0; i < 990; i++) {
+    H.add(20, 10000);
+  }
+  for(int i = 0; i < 10; i++) {
+    H.add(15000, 10000);
+  }
+  TEST_ASSERT_EQUAL(23, H.percentileUs(0.5f));     // the top of [16, 24)
+  TEST_ASSERT_EQUAL(23, H.percentileUs(0.99f));    // the tail is the last 1%
+  TEST_ASSERT_EQUAL(15000, H.percentileUs(0.999f));
+  TEST_ASSERT_EQUAL(10, H.overruns());
+}
+
+void testPhaseTimeTimesTheRestOfTheBlock() {
+  nativeHw.nowUs = 1000;
+  {
+    PHASE_TIME(PHASE_FLOAT);
+    nativeHw.nowUs += 37;
+  }
+  {
+    PHASE_TIME(PHASE_FLOAT);
+    PHASE_TIME(PHASE_HISTORY);    // nested ones each get their own
+    nativeHw.nowUs += CONTROL_PERIOD_MS * 1000 + 1;
+  }
+  const PhaseHistogram& F = phaseTimes[PHASE_FLOAT];
+  TEST_ASSERT_EQUAL(2, F.count());
+  TEST_ASSERT_EQUAL(37, F.minUs());
+  TEST_ASSERT_EQUAL(CONTROL_PERIOD_MS * 1000 + 1, F.maxUs());
+  TEST_ASSERT_EQUAL(1, F.overruns());
+  TEST_ASSERT_EQUAL(1, phaseTimes[PHASE_HISTORY].count());
+  TEST_ASSERT_EQUAL(0, phaseTimes[PHASE_CONTROL].count());
+}
+
+void testTimingStreamIsEveryPhaseInAnyChunkSize() {
+  phaseRecord(PHASE_LOOP, 1234);
+  std::string whole;
+  PhaseTimingStream S;
+  uint8_t buf[512];
+  size_t n;
+  while((n = S.read(buf, sizeof(buf))) > 0) {
+    whole.append((const char*)buf, n);
+  }
+  TEST_ASSERT_EQUAL(0, whole.find("{\"phases\":[{\"name\":\"control\","));
+  TEST_ASSERT_EQUAL(whole.size() - 2, whole.rfind("]}"));
+  TEST_ASSERT_TRUE(whole.find("{\"name\":\"loop\",\"count\":1,\"minus\":1234,") != std::string::npos);
+  size_t names = 0;
+  for(size_t at = whole.find("\"name\""); at != std::string::npos; at = whole.find("\"name\"", at + 1)) {
+    names++;
+  }
+  TEST_ASSERT_EQUAL(PHASE_COUNT, names);
+
+  for(size_t chunk = 1; chunk < 40; chunk += 7) {   // the web server asks for whatever fits in its buffer
+    std::string pieces;
+    PhaseTimingStream T;
+    while((n = T.read(buf, chunk)) > 0) {
+      TEST_ASSERT_TRUE(n <= chunk);
+      pieces.append((const char*)buf, n);
+    }
+    TEST_ASSERT_TRUE(pieces == whole);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testBucketsCoverEveryValueOnce);
+  RUN_TEST(testEmptyHistogram);
+  RUN_TEST(testMinMaxAndOverruns);
+  RUN_TEST(testPercentilesOfAUniformSpread);
+  RUN_TEST(testPercentilesAreNeverLowAndAtMostHalfHigh);
+  RUN_TEST(testPercentilesOfALongTail);
+  RUN_TEST(testPhaseTimeTimesTheRestOfTheBlock);
+  RUN_TEST(testTimingStreamIsEveryPhaseInAnyChunkSize);
+  return UNITY_END();
+}
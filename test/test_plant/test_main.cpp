@@ -0,0 +1,158 @@
+/*
+    The simulated kettle in native/kettlePlant.h on its own (heating at its power, the float switch and its
+    drop back band, repeatable noise), then one whole fill and heat with the control logic stepping against
+    it. pio test -e native -f test_plant
+*/
+
+#include <stdint.h>
+#include "config/userSettingsSAMPLE.h"
+
+#include <unity.h>
+
+#include "kettleControl.h"
+#include "native/kettlePlant.h"
+
+const int64_t stepUs = CONTROL_PERIOD_MS * 1000LL;
+
+void setUp() {
+  nativeHw.pump = false;
+  nativeHw.armAngle = KETTLE_NEUTRAL;
+}
+
+void tearDown() {}
+
+plantParams quietPlant() {    // no noise and no lag, so the numbers can be worked out by hand
+  plantParams P = defaultPlant;
+  P.sensorNoiseC = 0;
+  P.sensorTauS = 0.01f;
+  return P;
+}
+
+void testElementBoilsAtItsPowerThenTrips() {
+  plantParams P = quietPlant();
+  P.startL = 1.2f;
+  KettlePlant K;
+  K.begin(P);
+  nativeHw.armAngle = KETTLE_ON;
+  float s = 0;
+  while(K.waterC < P.boilC && s < 600) {
+    K.step(1000000);
+    s += 1;
+  }
+  // (1.2L * 4186 + 400) J/K * 80K at 2200W * 0.9 is 219s, the losses add a little
+  float ideal = (P.startL * 4186 + P.kettleJPerK) * (P.boilC - P.ambientC) / (P.heaterW * P.efficiency);
+  TEST_ASSERT_TRUE(s >= ideal);
+  TEST_ASSERT_TRUE(s < ideal * 1.1f);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, P.boilC, nativeHw.probeC[0]);
+
+  for(int i = 0; i < P.steamTripS + 1; i++) {
+    K.step(1000000);
+  }
+  TEST_ASSERT_FALSE(K.element);
+  TEST_ASSERT_EQUAL(1, K.selfTrips);
+  TEST_ASSERT_TRUE(K.boiledOffL > 0);
+  TEST_ASSERT_TRUE(K.waterC < P.boilC);
+}
+
+void testFloatComesUpAndDropsBackInItsBand() {
+  plantParams P = quietPlant();
+  KettlePlant K;
+  K.begin(P);
+  TEST_ASSERT_EQUAL(LOW, nativeHw.floatLevel);
+  nativeHw.pump = true;
+  while(nativeHw.pump && K.waterL < P.capacityL) {
+    K.step(stepUs);
+  }
+  TEST_ASSERT_EQUAL(HIGH, nativeHw.floatLevel);   // and that cut the pump, like the interrupt on the kettle
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, P.floatL, K.waterL);
+  TEST_ASSERT_EQUAL(0, K.spilledL);
+
+  K.waterL = P.floatL - P.floatDropL / 2;
+  K.step(stepUs);
+  TEST_ASSERT_EQUAL(HIGH, nativeHw.floatLevel);
+  K.waterL = P.floatL - P.floatDropL * 2;
+  K.step(stepUs);
+  TEST_ASSERT_EQUAL(LOW, nativeHw.floatLevel);
+}
+
+void testSameSeedGivesTheSameNoise() {
+  plantParams P = defaultPlant;
+  float first[50];
+  KettlePlant K;
+  K.begin(P);
+  for(int i = 0; i < 50; i++) {
+    K.step(stepUs);
+    first[i] = nativeHw.probeC[0];
+  }
+  K.begin(P);
+  bool noisy = false;
+  for(int i = 0; i < 50; i++) {
+    K.step(stepUs);
+    TEST_ASSERT_EQUAL_FLOAT(first[i], nativeHw.probeC[0]);
+    noisy |= first[i] != P.ambientC;
+  }
+  TEST_ASSERT_TRUE(noisy);
+  P.seed++;
+  K.begin(P);
+  K.step(stepUs);
+  TEST_ASSERT_TRUE(nativeHw.probeC[0] != first[0]);
+}
+
+// Fills from boot, then leaves the water to stand with no heat lost, so the probes read exactly the same for
+// longer than TEMP_STUCK_MS before the heat is asked for. That must not count as a stuck probe once it comes on.
+void testFillStandThenHeatFromBoot() {
+  plantParams P = quietPlant();
+  P.lossWPerK = 0;
+  P.sensorTauS = 4;
+  KettlePlant K;
+  nativeHw.quiet = true;
+  nativeHw.probes = MAX_PROBES;
+  nativeHw.floatCuts = 0;
+  K.begin(P);
+  halFloatBegin();
+  controlBegin();
+
+  int64_t pumpOnAt = -1, pumpOffAt = -1, heatOnAt = -1, heatOffAt = -1;
+  for(int64_t t = 0; t < 3600000000LL && heatOffAt < 0; t += stepUs) {
+    nativeHw.nowUs = t;
+    if(t == 5000000) {
+      queueCommand(CMD_PUMP_ON);
+    }
+    if(pumpOffAt >= 0 && t == pumpOffAt + TEMP_STUCK_MS * 1000LL + 30000000) {
+      queueCommand(CMD_HEAT_ON);
+    }
+    bool pumpWas = pumpStatus == HIGH;
+    bool heatWas = heatStatus == HIGH;
+    K.step(stepUs);
+    controlStep();
+    if(!pumpWas && pumpStatus == HIGH) {
+      pumpOnAt = t;
+    } else if(pumpWas && pumpStatus == LOW) {
+      pumpOffAt = t;
+    }
+    if(!heatWas && heatStatus == HIGH) {
+      heatOnAt = t;
+    } else if(heatWas && heatStatus == LOW) {
+      heatOffAt = t;
+    }
+  }
+  TEST_ASSERT_TRUE(pumpOnAt >= 0 && pumpOffAt > pumpOnAt);
+  TEST_ASSERT_TRUE(pumpOffAt - pumpOnAt < (int64_t)timeoutPump * 1000);   // the float stopped it, not the timeout
+  TEST_ASSERT_EQUAL(1, nativeHw.floatCuts);
+  TEST_ASSERT_EQUAL(0, K.spilledL);
+
+  TEST_ASSERT_TRUE(heatOnAt > pumpOffAt);
+  TEST_ASSERT_TRUE(heatOffAt > heatOnAt);
+  TEST_ASSERT_TRUE(heatOffAt - heatOnAt > 200000000LL);    // it got to the boil instead of a sensor fault cutting it short
+  TEST_ASSERT_TRUE(heatOffAt - heatOnAt <= (int64_t)timeoutHeat * 1000 + stepUs);
+  TEST_ASSERT_TRUE(K.peakC >= P.boilC - 0.01f);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testElementBoilsAtItsPowerThenTrips);
+  RUN_TEST(testFloatComesUpAndDropsBackInItsBand);
+  RUN_TEST(testSameSeedGivesTheSameNoise);
+  RUN_TEST(testFillStandThenHeatFromBoot);
+  return UNITY_END();
+}
@@ -0,0 +1,43 @@
+/*
+    Replays the golden control trace (test/traces/goldenTrace.h) through this build's control logic and
+    expects every pump and arm decision at the step it was recorded at. A difference means the control logic
+    now behaves differently on the same inputs, which is either a bug or needs a new golden trace.
+    pio test -e native -f test_replay
+*/
+
+#include <stdint.h>
+#include "config/userSettingsSAMPLE.h"
+
+#include <unity.h>
+
+#include "native/traceReplay.h"
+#include "traces/goldenTrace.h"
+
+void setUp() {}
+void tearDown() {}
+
+void testGoldenTraceReplaysWithoutDifferences() {
+  std::vector<uint8_t> trace = loadGoldenTrace();
+  TEST_ASSERT_TRUE_MESSAGE(trace.size() > 0, "can't read test/traces/golden.tbkt");
+
+  nativeHw.quiet = true;
+  FILE* log = tmpfile();    // every decision is printed, only the counts matter here
+  TEST_ASSERT_TRUE(log != NULL);
+  TraceReplay R(log);
+  bool ran = R.run(trace.data(), trace.size());
+  fclose(log);
+  TEST_ASSERT_TRUE_MESSAGE(ran, "this build can't replay the golden trace, see replay's output for why");
+
+  const replayStats& S = R.stats();
+  TEST_ASSERT_EQUAL(0, S.differences);
+  TEST_ASSERT_EQUAL(12, S.segments);
+  TEST_ASSERT_EQUAL(0, S.restarts);
+  TEST_ASSERT_EQUAL(61733, S.steps);    // the whole run, boot to the heat timing out
+  TEST_ASSERT_EQUAL(7, S.outputs);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testGoldenTraceReplaysWithoutDifferences);
+  return UNITY_END();
+}
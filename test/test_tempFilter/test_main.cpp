@@ -0,0 +1,159 @@
+/*
+    TempFilter on the probe readings recorded in the golden control trace (test/traces/goldenTrace.h): a clean
+    fill and heat has to go through without a single fault, and the same readings with a disconnected probe
+    (-127), a power-on reset (85), a spike or a stuck probe spliced in have to be caught on that reading,
+    without the bad value ever reaching the filtered temperature. pio test -e native -f test_tempFilter
+*/
+
+#include <stdint.h>
+#include "config/userSettingsSAMPLE.h"
+
+#include <unity.h>
+#include <vector>
+
+#include "kettleControl.h"
+#include "traces/goldenTrace.h"
+
+void setUp() {}
+void tearDown() {}
+
+// Just the control probe's readings, which is what the heat cut off goes by
+std::vector<recordedReading> controlReadings() {
+  std::vector<recordedReading> all = goldenReadings();
+  std::vector<recordedReading> control;
+  for(size_t i = 0; i < all.size(); i++) {
+    if(all[i].probe == CONTROL_PROBE) {
+      control.push_back(all[i]);
+    }
+  }
+  return control;
+}
+
+TempFilter<TEMP_MEDIAN> makeFilter() {
+  return TempFilter<TEMP_MEDIAN>(TEMP_MAX_SLEW, TEMP_STUCK_MS * 1000LL);   // as controlBegin() sets them up
+}
+
+void testGoldenTraceHasNoFaults() {
+  std::vector<recordedReading> readings = goldenReadings();
+  TEST_ASSERT_TRUE_MESSAGE(readings.size() > 1000, "can't read the probe readings from test/traces/golden.tbkt");
+
+  TempFilter<TEMP_MEDIAN> filters[MAX_PROBES];
+  for(int i = 0; i < MAX_PROBES; i++) {
+    filters[i] = makeFilter();
+  }
+  bool sawHeating = false;
+  float hottest = 0;
+  for(size_t i = 0; i < readings.size(); i++) {
+    const recordedReading& R = readings[i];
+    TEST_ASSERT_TRUE(R.probe < MAX_PROBES);
+    TEST_ASSERT_EQUAL(TEMP_OK, filters[R.probe].add(R.rawC, R.atUs, R.heating));
+    TEST_ASSERT_FLOAT_WITHIN(1.0f, R.rawC, filters[R.probe].value());    // it lags a heating kettle a little, never by much
+    sawHeating |= R.heating;
+    hottest = R.rawC > hottest ? R.rawC : hottest;
+  }
+  TEST_ASSERT_TRUE(sawHeating);
+  TEST_ASSERT_TRUE(hottest > 95.0f);    // the readings really do go up to the boil
+}
+
+void testDisconnectedProbeIsCaughtAndSkipped() {
+  std::vector<recordedReading> readings = controlReadings();
+  TempFilter<TEMP_MEDIAN> F = makeFilter();
+  TEST_ASSERT_EQUAL(TEMP_FAULT_DISCONNECTED, F.add(PROBE_DISCONNECTED_C, 0, false));
+  TEST_ASSERT_FALSE(F.ready());
+  uint32_t caught = 0;
+  for(size_t i = 0; i < readings.size(); i++) {
+    const recordedReading& R = readings[i];
+    if(i % 50 == 25) {
+      float before = F.value();
+      TEST_ASSERT_EQUAL(TEMP_FAULT_DISCONNECTED, F.add(PROBE_DISCONNECTED_C, R.atUs, R.heating));
+      TEST_ASSERT_EQUAL_FLOAT(before, F.value());
+      TEST_ASSERT_EQUAL(0, F.goodRun());
+      caught++;
+    } else {
+      TEST_ASSERT_EQUAL(TEMP_OK, F.add(R.rawC, R.atUs, R.heating));   // and the next good reading is fine again
+    }
+  }
+  TEST_ASSERT_TRUE(caught > 10);
+}
+
+void testPowerOnResetIsCaught() {
+  std::vector<recordedReading> readings = controlReadings();
+  TempFilter<TEMP_MEDIAN> F = makeFilter();
+  TEST_ASSERT_EQUAL(TEMP_FAULT_POWER_ON, F.add(85.0f, readings[0].atUs, false));   // first thing after boot
+  TEST_ASSERT_FALSE(F.ready());
+  uint32_t caught = 0;
+  for(size_t i = 0; i < readings.size(); i++) {
+    const recordedReading& R = readings[i];
+    if(i % 200 == 100 && fabsf(R.rawC - 85.0f) > 10) {    // a brown out part way through
+      float before = F.value();
+      TEST_ASSERT_EQUAL(TEMP_FAULT_POWER_ON, F.add(85.0f, R.atUs, R.heating));
+      TEST_ASSERT_EQUAL_FLOAT(before, F.value());
+      caught++;
+    }
+    TEST_ASSERT_EQUAL(TEMP_OK, F.add(R.rawC, R.atUs, R.heating));
+  }
+  TEST_ASSERT_TRUE(caught > 5);
+}
+
+void testSpikeIsCaughtAsSlew() {
+  std::vector<recordedReading> readings = controlReadings();
+  TempFilter<TEMP_MEDIAN> F = makeFilter();
+  uint32_t caught = 0;
+  for(size_t i = 0; i < readings.size(); i++) {
+    const recordedReading& R = readings[i];
+    if(i > 0 && i % 100 == 50) {
+      float before = F.value();
+      float spike = R.rawC > 60 ? R.rawC - 15 : R.rawC + 15;
+      TEST_ASSERT_EQUAL(TEMP_FAULT_SLEW, F.add(spike, R.atUs, R.heating));
+      TEST_ASSERT_EQUAL_FLOAT(before, F.value());
+      caught++;
+    }
+    TEST_ASSERT_EQUAL(TEMP_OK, F.add(R.rawC, R.atUs, R.heating));
+  }
+  TEST_ASSERT_TRUE(caught > 10);
+}
+
+void testStuckProbeIsCaughtOnlyWhileHeating() {
+  std::vector<recordedReading> readings = controlReadings();
+  size_t heatFrom = 0;
+  while(heatFrom < readings.size() && !readings[heatFrom].heating) {
+    heatFrom++;
+  }
+  TEST_ASSERT_TRUE(heatFrom < readings.size());
+
+  // The probe stops changing as the heat comes on and keeps reading the same as the kettle heats
+  TempFilter<TEMP_MEDIAN> F = makeFilter();
+  for(size_t i = 0; i < heatFrom; i++) {
+    F.add(readings[i].rawC, readings[i].atUs, false);
+  }
+  float frozen = readings[heatFrom].rawC;
+  int64_t frozenAt = readings[heatFrom].atUs;
+  bool caught = false;
+  for(size_t i = heatFrom; i < readings.size(); i++) {
+    tempFaults fault = F.add(frozen, readings[i].atUs, true);
+    if(readings[i].atUs - frozenAt < TEMP_STUCK_MS * 1000LL) {
+      TEST_ASSERT_EQUAL(TEMP_OK, fault);
+    } else {
+      TEST_ASSERT_EQUAL(TEMP_FAULT_STUCK, fault);
+      caught = true;
+      break;
+    }
+  }
+  TEST_ASSERT_TRUE(caught);
+
+  // The same frozen reading with the heat off is just water sitting there
+  TempFilter<TEMP_MEDIAN> idle = makeFilter();
+  for(size_t i = heatFrom; i < readings.size(); i++) {
+    TEST_ASSERT_EQUAL(TEMP_OK, idle.add(frozen, readings[i].atUs, false));
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testGoldenTraceHasNoFaults);
+  RUN_TEST(testDisconnectedProbeIsCaughtAndSkipped);
+  RUN_TEST(testPowerOnResetIsCaught);
+  RUN_TEST(testSpikeIsCaughtAsSlew);
+  RUN_TEST(testStuckProbeIsCaughtOnlyWhileHeating);
+  return UNITY_END();
+}
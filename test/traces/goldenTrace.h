@@ -0,0 +1,122 @@
+/*
+    golden.tbkt is the control trace (controlTrace.h) of one whole fill and heat of the simulated kettle, from
+    boot to the heat timing out: the pump filling until the float cuts it, the arm switching the kettle on,
+    and the readings all the way up to the boil and back down. test_replay replays it and expects the same
+    decisions at the same steps, test_tempFilter runs its probe readings through TempFilter and the archive
+    cases of the native micro-benchmarks (benchmarks.h) store them.
+
+    Made by the native program with the sample settings apart from TRACE_SEGMENTS 64 (the sample's 16KB
+    only holds the last few minutes, the trace format doesn't depend on it):
+      .pio/build/native/program -q -t test/traces/golden.tbkt
+    Only make it again when a change to the control logic is meant to change its decisions, and say so in
+    the commit.
+*/
+
+#ifndef GOLDEN_TRACE
+#define GOLDEN_TRACE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "kettleControl.h"
+
+// Empty if the file can't be read
+inline std::vector<uint8_t> loadGoldenTrace() {
+  std::string path = __FILE__;
+  path = path.substr(0, path.rfind('/') + 1) + "golden.tbkt";
+  std::vector<uint8_t> data;
+  FILE* in = fopen(path.c_str(), "rb");
+  if(in == NULL) {
+    return data;
+  }
+  uint8_t buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+  fclose(in);
+  return data;
+}
+
+struct recordedReading {
+  int64_t atUs;     // of the control step that read it
+  uint8_t probe;
+  float rawC;
+  bool heating;     // whether the kettle had been switched on, from the arm moves in the trace
+};
+
+// The TRACE_PROBE records of a trace in order. traceRestore() is only used to get past each keyframe's
+// snapshot, so this overwrites the control state, goldenReadings() puts it back.
+inline std::vector<recordedReading> traceReadings(const std::vector<uint8_t>& data) {
+  std::vector<recordedReading> readings;
+  size_t pos = 8;
+  bool heating = false;
+  while(pos + 2 <= data.size()) {
+    size_t segLen = data[pos] | data[pos + 1] << 8;
+    pos += 2;
+    if(pos + segLen > data.size()) {
+      break;
+    }
+    traceUnpacker U(data.data() + pos, segLen);
+    pos += segLen;
+    if((U.u8() & 0x0F) != TRACE_KEYFRAME) {
+      continue;
+    }
+    U.u32();
+    int64_t at = U.u64();
+    U.u32();
+    U.u8();
+    traceRestore(U);
+    heating = heatStatus == HIGH;
+    while(U.ok() && !U.done()) {
+      uint8_t t = U.u8();
+      switch(t & 0x0F) {
+        case TRACE_STEP: {
+          uint32_t steps = U.varint();
+          at += (int64_t)steps * CONTROL_PERIOD_MS * 1000 + U.zigzag();
+          break;
+        }
+        case TRACE_PROBE: {
+          recordedReading R = {at, (uint8_t)(t >> 4), (int16_t)U.u16() / 128.0f, heating};
+          readings.push_back(R);
+          break;
+        }
+        case TRACE_FLOAT:
+          U.zigzag();
+          break;
+        case TRACE_COMMAND:
+          U.varint();
+          U.varint();
+          break;
+        case TRACE_PUMP:
+          break;
+        case TRACE_ARM: {
+          uint32_t angle = U.varint();
+          if(angle == KETTLE_ON) {
+            heating = true;
+          } else if(angle == KETTLE_OFF) {
+            heating = false;
+          }
+          break;
+        }
+        default:
+          return readings;
+      }
+    }
+  }
+  return readings;
+}
+
+// The golden trace's probe readings, empty if the file can't be read. The control state is left as it was.
+inline std::vector<recordedReading> goldenReadings() {
+  tracePacker<sizeof(traceKeyframeBuf.buf)> saved;
+  traceSnapshot(saved);
+  std::vector<recordedReading> readings = traceReadings(loadGoldenTrace());
+  traceUnpacker U(saved.buf, saved.len);
+  traceRestore(U);
+  return readings;
+}
+
+#endif
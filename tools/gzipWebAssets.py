@@ -0,0 +1,90 @@
+# Packs the web page in web/ into src/webAssets.h as gzipped byte arrays, so the kettle can serve it from
+# flash without any internet access. Runs before every build from platformio.ini (extra_scripts), or by
+# hand with "python tools/gzipWebAssets.py" from the project folder.
+#
+# app.js and style.css are linked from the page with their ETag in the URL, so browsers can cache them
+# forever and still pick up a new version after an update. The page itself is revalidated every load.
+
+import gzip
+import hashlib
+import os
+
+try:
+    Import("env")   # noqa: F821 (provided by PlatformIO)
+    PROJECT_DIR = env["PROJECT_DIR"]   # noqa: F821
+except NameError:
+    PROJECT_DIR = os.getcwd()
+
+WEB_DIR = os.path.join(PROJECT_DIR, "web")
+OUTPUT = os.path.join(PROJECT_DIR, "src", "webAssets.h")
+
+# file in web/, URL path, content type, cache forever
+ASSETS = [
+    ("style.css", "/style.css", "text/css", True),
+    ("app.js", "/app.js", "application/javascript", True),
+    ("index.html", "/", "text/html", False),   # last, it links to the others by ETag
+]
+
+
+def pack(data):
+    gz = gzip.compress(data, compresslevel=9, mtime=0)    # mtime=0 so the same input always gives the same bytes
+    return gz, hashlib.sha256(gz).hexdigest()[:16]
+
+
+def main():
+    packed = []
+    etags = {}
+    for name, path, content_type, immutable in ASSETS:
+        with open(os.path.join(WEB_DIR, name), "rb") as f:
+            data = f.read()
+        if name == "index.html":
+            for linked, etag in etags.items():
+                data = data.replace(('"%s"' % linked).encode(), ('"%s?v=%s"' % (linked, etag)).encode())
+        gz, etag = pack(data)
+        etags[name] = etag
+        packed.append((name, path, content_type, immutable, gz, etag, len(data)))
+
+    out = ["// Generated by tools/gzipWebAssets.py from the files in web/, edit those instead",
+           "#ifndef WEB_ASSETS",
+           "#define WEB_ASSETS",
+           "",
+           "#include <Arduino.h>",
+           "",
+           "struct webAsset {",
+           "  const char* path;",
+           "  const char* contentType;",
+           "  const uint8_t* data;   // gzipped",
+           "  size_t len;",
+           "  const char* etag;",
+           "  bool immutable;        // the URL changes whenever the content does, so it can be cached forever",
+           "};",
+           ""]
+    for name, path, content_type, immutable, gz, etag, size in packed:
+        var = "web_" + name.replace(".", "_")
+        out.append("// %s: %d bytes, %d gzipped" % (name, size, len(gz)))
+        out.append("const uint8_t %s[] PROGMEM = {" % var)
+        for i in range(0, len(gz), 20):
+            out.append("  " + ", ".join("0x%02x" % b for b in gz[i:i + 20]) + ",")
+        out.append("};")
+        out.append("")
+    out.append("const webAsset webAssets[] = {")
+    for name, path, content_type, immutable, gz, etag, size in packed:
+        var = "web_" + name.replace(".", "_")
+        out.append('  {"%s", "%s", %s, sizeof(%s), "\\"%s\\"", %s},' % (path, content_type, var, var, etag, "true" if immutable else "false"))
+    out.append("};")
+    out.append("const size_t webAssetCount = sizeof(webAssets) / sizeof(webAssets[0]);")
+    out.append("")
+    out.append("#endif")
+    text = "\n".join(out) + "\n"
+
+    old = None
+    if os.path.exists(OUTPUT):
+        with open(OUTPUT) as f:
+            old = f.read()
+    if old != text:   # only touch the file when something changed, otherwise everything rebuilds
+        with open(OUTPUT, "w") as f:
+            f.write(text)
+        print("gzipWebAssets: wrote %s" % OUTPUT)
+
+
+main()
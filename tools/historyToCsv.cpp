@@ -0,0 +1,52 @@
+/*
+    Converts a binary history export from a kettle (/api/history.bin) to CSV.
+
+    Build:  g++ -std=c++11 -O2 -I../src -o historyToCsv historyToCsv.cpp
+    Use:    curl -s http://tipsybrewkettle.local/api/history.bin | ./historyToCsv > history.csv
+            ./historyToCsv history.bin > history.csv
+
+    Output columns: epoch seconds, UTC time, temperature in degrees C
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+
+#include "binaryExport.h"
+
+int main(int argc, char** argv) {
+  FILE* in = stdin;
+  if(argc > 1) {
+    in = fopen(argv[1], "rb");
+    if(in == NULL) {
+      fprintf(stderr, "Can't open %s\n", argv[1]);
+      return 1;
+    }
+  }
+
+  std::vector<uint8_t> data;
+  uint8_t buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+
+  printf("epoch,time,temp\n");
+  uint16_t width;
+  long count = decodeBinaryHistory(data.data(), data.size(), width, [](const tempSample& S){
+    time_t t = S.epoch;
+    struct tm timeinfo;
+    gmtime_r(&t, &timeinfo);
+    char timeStr[24];
+    strftime(timeStr, sizeof(timeStr), "%Y-%m-%dT%H:%M:%SZ", &timeinfo);
+    char temp[12];
+    formatCentiC(temp, sizeof(temp), S.centiC);
+    printf("%u,%s,%s\n", (unsigned)S.epoch, timeStr, temp);
+  });
+  if(count < 0) {
+    fprintf(stderr, "Not a valid history export (or it was cut short)\n");
+    return 1;
+  }
+  fprintf(stderr, "%ld samples, nominally %us apart\n", count, (unsigned)width);
+  return 0;
+}
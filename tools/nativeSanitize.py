@@ -0,0 +1,7 @@
+# Builds the native env with AddressSanitizer and UndefinedBehaviorSanitizer. build_flags only reach the
+# compiler, the sanitizers need the same flags when linking too. Used from platformio.ini (extra_scripts).
+
+Import("env")   # noqa: F821 (provided by PlatformIO)
+
+SANITIZE = ["-fsanitize=address,undefined", "-fno-omit-frame-pointer", "-g"]
+env.Append(CCFLAGS=SANITIZE, LINKFLAGS=SANITIZE)   # noqa: F821
@@ -0,0 +1,115 @@
+// TipsyBrew Kettle page. No libraries so the page works without internet access, everything the kettle
+// knows comes from /status, /temps and the /ws WebSocket.
+var kettleStatus = {};
+var temps = {capacity: 0, data: []};
+var websocket;
+
+function $(id) { return document.getElementById(id); }
+
+function setButton(id, on, text) {   // on means the button offers to turn something on
+    var b = $(id);
+    b.className = "button " + (on ? "button-on" : "button-off");
+    b.innerHTML = text;
+}
+
+// Minimal line chart, draws temps.data onto the canvas
+function drawChart() {
+    var canvas = $("tempChart");
+    var ctx = canvas.getContext("2d");
+    var w = canvas.width, h = canvas.height, pad = 40;
+    ctx.clearRect(0, 0, w, h);
+    var points = temps.data;
+    var max = 0;
+    points.forEach(function(p) { if(p.temp > max) max = p.temp; });
+    max = Math.max(10, Math.ceil(max / 10) * 10);   // the old chart started at zero too
+    ctx.strokeStyle = "#ddd";
+    ctx.fillStyle = "#888";
+    ctx.font = "12px Helvetica";
+    ctx.lineWidth = 1;
+    for(var t = 0; t <= max; t += max / 5) {
+        var y = h - pad - (h - 2 * pad) * t / max;
+        ctx.beginPath(); ctx.moveTo(pad, y); ctx.lineTo(w - 10, y); ctx.stroke();
+        ctx.fillText(Math.round(t), 5, y + 4);
+    }
+    if(points.length == 0) return;
+    var step = points.length > 1 ? (w - pad - 10) / (points.length - 1) : 0;
+    ctx.fillText(points[0].timeLabel, pad, h - pad + 20);
+    ctx.fillText(points[points.length - 1].timeLabel, w - 70, h - pad + 20);
+    ctx.beginPath();
+    points.forEach(function(p, i) {
+        var x = pad + i * step;
+        var y = h - pad - (h - 2 * pad) * Math.max(0, p.temp) / max;
+        if(i == 0) ctx.moveTo(x, y); else ctx.lineTo(x, y);
+    });
+    ctx.strokeStyle = "rgba(255,99,132,1)";
+    ctx.lineWidth = 3;
+    ctx.stroke();
+}
+
+function showStatus(s) {
+    $("currentTemp").innerHTML = s.tempreading + "&#176;C";
+    if(s.probes && s.probes.length > 1) {   // only worth listing when there is more than the one probe
+        $("probes").innerHTML = s.probes.map(function(p) { return p.name + ": " + p.temp + "&#176;C"; }).join(" &middot; ");
+    }
+    $("pumpStatus").innerHTML = s.pump ? "ON" : "OFF";
+    setButton("pumpLink", !s.pump, s.pump ? "OFF" : "ON");
+    if(s.heat) {
+        $("heatStatus").innerHTML = "ON";
+        setButton("heatLink", false, "OFF");
+    } else if(s.pendingheat) {
+        $("heatStatus").innerHTML = "PENDING";
+        setButton("heatLink", false, "CANCEL");
+    } else {
+        $("heatStatus").innerHTML = "OFF";
+        setButton("heatLink", true, s.kettle ? "ON" : "FILL and HEAT");
+    }
+    $("datetime").innerHTML = s.datetime;
+    $("tbkVersion").innerHTML = "TBK version " + s.version;
+}
+
+function getJSON(url, done) {
+    var req = new XMLHttpRequest();
+    req.onload = function() { if(req.status == 200) done(JSON.parse(req.responseText)); };
+    req.open("GET", url);
+    req.send();
+}
+
+function sendCommand(cmd) {     // commands go over the WebSocket when it is up, otherwise over HTTP
+    if(websocket && websocket.readyState == WebSocket.OPEN) {
+        websocket.send(cmd);
+    } else {
+        getJSON(cmd, function(s) { kettleStatus = s; showStatus(s); });   // answered with the status the command left
+    }
+}
+
+function onMessage(event) {
+    var msg = JSON.parse(event.data);
+    console.log(msg);
+    if("ack" in msg) {      // result of a command we (or another client) sent, the new status follows it
+        return;
+    }
+    if("sample" in msg) {   // a new history reading, keep the chart the same length as the history on the kettle
+        temps.data.push(msg.sample);
+        if(temps.data.length > temps.capacity) temps.data.shift();
+        drawChart();
+        return;
+    }
+    kettleStatus = msg;
+    showStatus(kettleStatus);
+}
+
+function initWebSocket() {
+    console.log('Trying to open a WebSocket connection...');
+    websocket = new WebSocket(`ws://${window.location.hostname}/ws`);
+    websocket.onopen = function() { console.log('Connection opened'); };
+    websocket.onclose = function() { console.log('Connection closed'); setTimeout(initWebSocket, 2000); };
+    websocket.onmessage = onMessage;
+}
+
+getJSON("status", function(s) { kettleStatus = s; showStatus(s); });
+getJSON("temps", function(t) { temps = t; drawChart(); });
+initWebSocket();
+$("pumpLink").onclick = function() { sendCommand("pumptoggle"); };
+$("heatLink").onclick = function() {
+    if(kettleStatus.heat || kettleStatus.pendingheat) { sendCommand("heatoff"); } else if(kettleStatus.kettle) { sendCommand("heaton"); } else { sendCommand("fillandheat"); }
+};